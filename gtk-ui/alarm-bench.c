@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Benchmarks for /dev/alarm:
+ *   time    what reading the elapsed realtime clock costs, through the
+ *           ANDROID_ALARM_GET_TIME ioctl and through the mapped time page
+ *   cancel  threads setting alarms that are just due and clearing them as
+ *           they fire, timing the clears and the CPU they take
+ *   throughput
+ *           SET, CLEAR and GET_TIME from 1, 2, 4... threads, in ops/s
+ *
+ * Setting alarms needs write access to the device.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <linux/android_alarm_time.h>
+
+#include "hist.h"
+
+#define ITERATIONS 1000000
+#define MAX_THREADS 64
+
+/* How far past now cancel sets its alarms, and how long it waits before
+   clearing them, both picked at random up to this */
+#define CANCEL_JITTER_NS 200000
+
+/* From linux/android_alarm.h, which isn't in this tree */
+#define ANDROID_ALARM_RTC_WAKEUP 0
+#define ANDROID_ALARM_RTC 1
+#define ANDROID_ALARM_ELAPSED_REALTIME 3
+#define ANDROID_ALARM_CLEAR(type) _IO('a', 0 | ((type) << 4))
+#define ANDROID_ALARM_SET(type) \
+    _IOW('a', 2 | ((type) << 4), struct timespec)
+#define ANDROID_ALARM_GET_TIME(type) \
+    _IOW('a', 4 | ((type) << 4), struct timespec)
+
+static const char *device = "/dev/alarm";
+static int nthreads = 4;
+static int seconds = 5;
+static int one_queue;           /* all threads on one alarm type */
+
+struct worker {
+    pthread_t thread;
+    int fd;
+    int type;
+    unsigned int seed;
+    unsigned long ops;
+    struct hist latency;
+};
+
+static struct worker workers[MAX_THREADS];
+static pthread_barrier_t start_barrier;
+static int stop;
+
+static int64_t now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t get_time(int fd, int type)
+{
+    struct timespec ts;
+
+    if (0 > ioctl(fd, ANDROID_ALARM_GET_TIME(type), &ts)) {
+        return -1;
+    }
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t read_ioctl(int fd)
+{
+    return get_time(fd, ANDROID_ALARM_ELAPSED_REALTIME);
+}
+
+static int set_alarm(int fd, int type, int64_t when)
+{
+    struct timespec ts;
+
+    ts.tv_sec = when / 1000000000LL;
+    ts.tv_nsec = when % 1000000000LL;
+    return ioctl(fd, ANDROID_ALARM_SET(type), &ts);
+}
+
+static double cpu_seconds(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static int64_t read_page(const volatile struct android_alarm_time *page)
+{
+    uint32_t seq;
+    int64_t base, delta;
+
+    do {
+        while ((seq = page->seq) & 1) {
+            /* the kernel is updating it */
+        }
+        __sync_synchronize();
+        if (page->stopped) {
+            base = page->stopped_ns;
+        } else {
+            struct timespec ts;
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            base = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        }
+        delta = page->delta_ns;
+        __sync_synchronize();
+    } while (page->seq != seq);
+
+    return base - delta;
+}
+
+static int time_mode(void)
+{
+    volatile struct android_alarm_time *page;
+    int64_t start, ioctl_ns, page_ns, a, b;
+    int fd, i;
+
+    if (0 > (fd = open(device, O_RDONLY))) {
+        printf("Failed to open %s, %s\n", device, strerror(errno));
+        return -1;
+    }
+
+    page = mmap(0, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+        printf("Failed to mmap the time page, %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* Both should agree, give or take the time between the reads */
+    a = read_ioctl(fd);
+    b = read_page(page);
+    if (a < 0) {
+        printf("Failed to get the time, %s\n", strerror(errno));
+        return -1;
+    }
+    printf("ioctl %lld ns, page %lld ns, apart %lld ns\n",
+           (long long)a, (long long)b, (long long)(b - a));
+
+    start = now();
+    for (i = 0; i < ITERATIONS; i++) {
+        read_ioctl(fd);
+    }
+    ioctl_ns = now() - start;
+
+    start = now();
+    for (i = 0; i < ITERATIONS; i++) {
+        read_page(page);
+    }
+    page_ns = now() - start;
+
+    printf("%10s %12s\n", "path", "ns/call");
+    printf("%10s %12.1f\n", "ioctl", (double)ioctl_ns / ITERATIONS);
+    printf("%10s %12.1f\n", "page", (double)page_ns / ITERATIONS);
+
+    return 0;
+}
+
+/* Non-wakeup types, whose alarms can go off without keeping the system
+   awake. Each has its own queue in the driver. */
+static int worker_type(int i)
+{
+    if (one_queue || i % 2) {
+        return ANDROID_ALARM_ELAPSED_REALTIME;
+    }
+    return ANDROID_ALARM_RTC;
+}
+
+static void *cancel_worker(void *ptr)
+{
+    struct worker *w = ptr;
+    struct timespec pause = { 0, 0 };
+    uint64_t start;
+
+    pthread_barrier_wait(&start_barrier);
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        /* Due within the jitter, so the clear lands before, during or
+           after the driver runs the alarm */
+        if (set_alarm(w->fd, w->type, get_time(w->fd, w->type) +
+                      rand_r(&w->seed) % CANCEL_JITTER_NS) < 0) {
+            printf("Failed to set an alarm, %s\n", strerror(errno));
+            break;
+        }
+        pause.tv_nsec = rand_r(&w->seed) % CANCEL_JITTER_NS;
+        nanosleep(&pause, NULL);
+
+        start = hist_now();
+        ioctl(w->fd, ANDROID_ALARM_CLEAR(w->type));
+        hist_add(&w->latency, hist_now() - start);
+        w->ops++;
+    }
+    return NULL;
+}
+
+/* Run fn in n threads, each with its own open of the device, for the
+   configured time. Returns the wall time taken in seconds. */
+static double run_workers(int n, void *(*fn)(void *))
+{
+    uint64_t start;
+    int i;
+
+    pthread_barrier_init(&start_barrier, NULL, n + 1);
+    stop = 0;
+    for (i = 0; i < n; i++) {
+        struct worker *w = &workers[i];
+
+        if (0 > (w->fd = open(device, O_RDWR))) {
+            printf("Failed to open %s, %s\n", device, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        w->type = worker_type(i);
+        w->seed = i + 1;
+        w->ops = 0;
+        hist_init(&w->latency);
+        if (pthread_create(&w->thread, NULL, fn, w)) {
+            printf("Failed to create a worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    start = hist_now();
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < n; i++) {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].fd);
+    }
+    pthread_barrier_destroy(&start_barrier);
+
+    return (hist_now() - start) / 1e9;
+}
+
+static void *throughput_worker(void *ptr)
+{
+    struct worker *w = ptr;
+    int64_t later;
+
+    /* Spread over the four queues the driver locks separately. Alarms are
+       set an hour out and never go off. */
+    w->type = one_queue ? ANDROID_ALARM_ELAPSED_REALTIME
+                        : ANDROID_ALARM_RTC_WAKEUP + (w - workers) % 4;
+    later = get_time(w->fd, w->type) + 3600 * 1000000000LL;
+
+    pthread_barrier_wait(&start_barrier);
+    if (set_alarm(w->fd, w->type, later) < 0) {
+        printf("Failed to set an alarm, %s\n", strerror(errno));
+        return NULL;
+    }
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        set_alarm(w->fd, w->type, later);
+        ioctl(w->fd, ANDROID_ALARM_CLEAR(w->type));
+        get_time(w->fd, w->type);
+        w->ops += 3;
+    }
+    return NULL;
+}
+
+static int throughput_mode(void)
+{
+    unsigned long ops;
+    double wall;
+    int n, i;
+
+    printf("%s, %d s per run\n", one_queue ? "one queue" : "four queues",
+           seconds);
+    printf("%8s %14s %14s\n", "threads", "ops/s", "ns/op/thread");
+    for (n = 1; ; n = n * 2 < nthreads ? n * 2 : nthreads) {
+        wall = run_workers(n, throughput_worker);
+        ops = 0;
+        for (i = 0; i < n; i++) {
+            ops += workers[i].ops;
+        }
+        printf("%8d %14.0f %14.1f\n", n, ops / wall,
+               ops ? wall * 1e9 * n / ops : 0);
+        if (n == nthreads) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int cancel_mode(void)
+{
+    struct hist latency;
+    double cpu, wall;
+    int i;
+
+    cpu = cpu_seconds();
+    wall = run_workers(nthreads, cancel_worker);
+    cpu = cpu_seconds() - cpu;
+
+    hist_init(&latency);
+    for (i = 0; i < nthreads; i++) {
+        hist_merge(&latency, &workers[i].latency);
+    }
+
+    printf("%d threads, %s, %.1f s\n", nthreads,
+           one_queue ? "one queue" : "two queues", wall);
+    printf("clear: n=%llu avg %.1f p50 %.1f p99 %.1f max %.1f us\n",
+           (unsigned long long)latency.count,
+           latency.count ? latency.sum / 1e3 / latency.count : 0,
+           hist_percentile(&latency, 0.50) / 1e3,
+           hist_percentile(&latency, 0.99) / 1e3, latency.max / 1e3);
+    printf("cpu: %.2f s, %.0f%% of one core\n", cpu, 100 * cpu / wall);
+
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-t threads] [-s seconds] [-1] "
+           "[time|cancel|throughput] [device]\n"
+           "  -t  threads, the most for throughput, default %d\n"
+           "  -s  how long each run takes, default %d\n"
+           "  -1  put every thread's alarms on the same queue\n",
+           name, nthreads, seconds);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *mode = "time";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:s:1h")) != -1) {
+        switch (opt) {
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        case '1':
+            one_queue = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (nthreads < 1 || nthreads > MAX_THREADS) {
+        printf("Threads must be between 1 and %d\n", MAX_THREADS);
+        return -1;
+    }
+    if (optind < argc) {
+        mode = argv[optind++];
+    }
+    if (optind < argc) {
+        device = argv[optind++];
+    }
+
+    if (!strcmp(mode, "time")) {
+        return time_mode();
+    }
+    if (!strcmp(mode, "cancel")) {
+        return cancel_mode();
+    }
+    if (!strcmp(mode, "throughput")) {
+        return throughput_mode();
+    }
+    usage(argv[0]);
+    return -1;
+}
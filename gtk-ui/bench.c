@@ -0,0 +1,584 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Benchmarks for the display and input hot paths: framebuffer copies,
+ * pixel conversion, damage handling, painting and input injection.
+ * Results are written as JSON, one object per case, with the median and
+ * the best of a fixed number of runs. Inputs come from a fixed seed so
+ * runs are comparable between builds. Exits non-zero if a conversion
+ * kernel disagrees with the scalar one.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#ifdef BENCH_CAIRO
+#include <cairo.h>
+#endif
+
+#include "capture.h"
+#include "convert.h"
+#include "inject.h"
+
+#define REPEATS 7
+#define SEED 1
+
+/* Total work per timed run, split into iterations of one frame each */
+#define RUN_PIXELS (32 * 1024 * 1024)
+
+#define INJECT_GESTURES 20000
+#define INJECT_MOVES 8      /* motion events per gesture */
+#define INJECT_IN_FLIGHT 256 /* calls not handled yet, well below the
+                                injector's queue size so none drop */
+
+static const struct {
+    int width, height;
+} sizes[] = {
+    { 640, 480 },
+    { 1280, 800 },
+    { 1920, 1080 },
+};
+
+#define NSIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+static FILE *out;
+static int results;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+struct timing {
+    double median, min;     /* seconds per iteration */
+};
+
+/* Run fn iterations times per run, REPEATS runs after one to warm up */
+static struct timing time_runs(void (*fn)(void *), void *arg,
+                               int iterations)
+{
+    double runs[REPEATS];
+    struct timing t;
+    int r, i;
+
+    for (r = -1; r < REPEATS; r++) {
+        double start = now();
+
+        for (i = 0; i < iterations; i++) {
+            fn(arg);
+        }
+        if (r >= 0) {
+            runs[r] = (now() - start) / iterations;
+        }
+    }
+
+    qsort(runs, REPEATS, sizeof(runs[0]), compare_double);
+    t.median = runs[REPEATS / 2];
+    t.min = runs[0];
+    return t;
+}
+
+static int iterations_for(int pixels)
+{
+    return RUN_PIXELS / pixels > 0 ? RUN_PIXELS / pixels : 1;
+}
+
+/* One result. Times are per iteration in ms, throughput is per second of
+   the median run in the given unit. */
+static void result(const char *group, const char *name, int width,
+                   int height, int iterations, struct timing t,
+                   double work, const char *unit)
+{
+    fprintf(out, "%s\n    {\"group\": \"%s\", \"name\": \"%s\", "
+            "\"width\": %d, \"height\": %d, \"iterations\": %d, "
+            "\"median_ms\": %.6f, \"min_ms\": %.6f, "
+            "\"throughput\": %.3f, \"unit\": \"%s\"}",
+            results++ ? "," : "", group, name, width, height, iterations,
+            t.median * 1e3, t.min * 1e3, work / t.median, unit);
+}
+
+static uint8_t *random_buffer(size_t len)
+{
+    uint8_t *buf = malloc(len);
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = rand();
+    }
+    return buf;
+}
+
+/* Framebuffer copies, the ways capture could get pixels out of the front
+   buffer */
+
+struct copy_case {
+    uint32_t *dst;
+    uint8_t *src;
+    int width, height;
+    int src_stride;             /* bytes, padded like a panned fb */
+    int rows;                   /* converted by "damaged" */
+    convert_func convert;
+};
+
+static void copy_memcpy(void *arg)
+{
+    struct copy_case *c = arg;
+
+    memcpy(c->dst, c->src, c->height * c->src_stride);
+}
+
+static void copy_rows(void *arg)
+{
+    struct copy_case *c = arg;
+    int y;
+
+    for (y = 0; y < c->height; y++) {
+        memcpy(c->dst + y * c->width, c->src + y * c->src_stride,
+               c->width * 4);
+    }
+}
+
+static void copy_convert(void *arg)
+{
+    struct copy_case *c = arg;
+
+    convert_rows(c->convert, c->dst, c->width * 4, c->src, c->src_stride,
+                 c->width, c->height);
+}
+
+static void copy_damaged(void *arg)
+{
+    struct copy_case *c = arg;
+
+    convert_rows(c->convert, c->dst, c->width * 4, c->src, c->src_stride,
+                 c->width, c->rows);
+}
+
+static void bench_copy(void)
+{
+    static const struct {
+        const char *name;
+        void (*fn)(void *);
+        int eighth;             /* only an eighth of the rows */
+    } strategies[] = {
+        { "memcpy", copy_memcpy, 0 },
+        { "rows", copy_rows, 0 },
+        { "convert", copy_convert, 0 },
+        { "damaged-eighth", copy_damaged, 1 },
+    };
+    int s, i;
+
+    for (s = 0; s < NSIZES; s++) {
+        struct copy_case c;
+        int n = sizes[s].width * sizes[s].height;
+
+        c.width = sizes[s].width;
+        c.height = sizes[s].height;
+        c.src_stride = c.width * 4 + 64;
+        c.rows = c.height / 8;
+        c.src = random_buffer(c.height * c.src_stride);
+        c.dst = malloc(c.height * c.src_stride);
+        c.convert = convert_select(PIXEL_FORMAT_XRGB8888);
+
+        for (i = 0; i < (int)(sizeof(strategies) / sizeof(strategies[0]));
+             i++) {
+            int rows = strategies[i].eighth ? c.rows : c.height;
+            int iterations = iterations_for(n);
+            struct timing t = time_runs(strategies[i].fn, &c, iterations);
+
+            result("copy", strategies[i].name, c.width, c.height,
+                   iterations, t, (double)c.width * rows * 4 / 1e6, "MB/s");
+        }
+
+        free(c.src);
+        free(c.dst);
+    }
+}
+
+/* Pixel conversion, every kernel checked against the scalar one first */
+
+struct convert_case {
+    convert_func convert;
+    uint32_t *dst;
+    uint8_t *src;
+    int n;
+    int width, height;
+    uint8_t *yuv;
+};
+
+static void convert_frame(void *arg)
+{
+    struct convert_case *c = arg;
+
+    c->convert(c->dst, c->src, c->n);
+}
+
+static void convert_i420(void *arg)
+{
+    struct convert_case *c = arg;
+    int cw = (c->width + 1) / 2, ch = (c->height + 1) / 2;
+    uint8_t *y = c->yuv;
+
+    convert_xrgb_to_i420(y, y + c->n, y + c->n + cw * ch,
+                         (uint32_t *)c->src, c->width, c->height);
+}
+
+static int bench_convert(void)
+{
+    enum convert_isa best = convert_best_isa();
+    int s, format, isa, failed = 0;
+
+    for (s = 0; s < NSIZES; s++) {
+        struct convert_case c;
+        uint32_t *ref;
+        struct timing t;
+        int iterations;
+
+        c.width = sizes[s].width;
+        c.height = sizes[s].height;
+        c.n = c.width * c.height;
+        c.src = random_buffer(c.n * 4);
+        c.dst = malloc(c.n * 4);
+        c.yuv = malloc(c.n * 2);
+        ref = malloc(c.n * 4);
+        iterations = iterations_for(c.n);
+
+        for (format = PIXEL_FORMAT_UNKNOWN + 1; format < PIXEL_FORMAT_COUNT;
+             format++) {
+            convert_get(format, CONVERT_SCALAR)(ref, c.src, c.n);
+
+            for (isa = CONVERT_SCALAR; isa <= (int)best; isa++) {
+                char name[64];
+
+                if ((c.convert = convert_get(format, isa)) == NULL) {
+                    continue;
+                }
+                snprintf(name, sizeof(name), "%s/%s",
+                         pixel_format_name(format), convert_isa_name(isa));
+
+                /* Odd length to exercise the tail handling too */
+                memset(c.dst, 0, c.n * 4);
+                c.convert(c.dst, c.src, c.n - 1);
+                if (memcmp(c.dst, ref, (c.n - 1) * 4)) {
+                    fprintf(stderr, "%s: output differs from scalar\n",
+                            name);
+                    failed = 1;
+                    continue;
+                }
+
+                t = time_runs(convert_frame, &c, iterations);
+                result("convert", name, c.width, c.height, iterations, t,
+                       c.n / 1e6, "Mpix/s");
+            }
+        }
+
+        /* What --headless --format y4m costs on top */
+        t = time_runs(convert_i420, &c, iterations);
+        result("convert", "XRGB8888/i420", c.width, c.height, iterations, t,
+               c.n / 1e6, "Mpix/s");
+
+        free(c.src);
+        free(c.dst);
+        free(c.yuv);
+        free(ref);
+    }
+
+    return failed;
+}
+
+/* Damage: turning vfb's page bitmap into row bands, against finding the
+   changed rows by comparing with the previous frame */
+
+struct damage_case {
+    unsigned char *map;
+    int line_length, height;
+    uint8_t *prev, *cur;
+    int changed;
+};
+
+static void damage_from_map(void *arg)
+{
+    struct damage_case *c = arg;
+    struct damage_band bands[MAX_DAMAGE_BANDS];
+
+    damage_bands(c->map, 0, c->height, c->line_length, bands,
+                 MAX_DAMAGE_BANDS);
+}
+
+static void damage_from_compare(void *arg)
+{
+    struct damage_case *c = arg;
+    int y;
+
+    c->changed = 0;
+    for (y = 0; y < c->height; y++) {
+        if (memcmp(c->prev + y * c->line_length, c->cur + y * c->line_length,
+                   c->line_length)) {
+            c->changed++;
+        }
+    }
+}
+
+static void bench_damage(void)
+{
+    static const struct {
+        const char *name;
+        int every;      /* every nth page damaged, 0 for a band */
+    } patterns[] = {
+        { "map/band", 0 },
+        { "map/every-4th-page", 4 },
+        { "map/full", 1 },
+    };
+    unsigned long page_size = sysconf(_SC_PAGESIZE);
+    int s, i;
+
+    for (s = 0; s < NSIZES; s++) {
+        struct damage_case c;
+        size_t len;
+        unsigned long pages, page;
+        int iterations;
+        struct timing t;
+
+        c.height = sizes[s].height;
+        c.line_length = sizes[s].width * 2;
+        len = c.height * c.line_length;
+        pages = (len + page_size - 1) / page_size;
+        c.map = malloc((pages + 7) / 8);
+
+        for (i = 0; i < (int)(sizeof(patterns) / sizeof(patterns[0])); i++) {
+            memset(c.map, 0, (pages + 7) / 8);
+            for (page = 0; page < pages; page++) {
+                int hit = patterns[i].every ? page % patterns[i].every == 0
+                                            : page >= pages / 2 &&
+                                              page < pages / 2 + pages / 16;
+
+                if (hit) {
+                    c.map[page >> 3] |= 1 << (page & 7);
+                }
+            }
+
+            iterations = 100000;
+            t = time_runs(damage_from_map, &c, iterations);
+            result("damage", patterns[i].name, sizes[s].width, c.height,
+                   iterations, t, 1, "frames/s");
+        }
+
+        /* A band of an eighth of the screen changed */
+        c.prev = random_buffer(len);
+        c.cur = malloc(len);
+        memcpy(c.cur, c.prev, len);
+        memset(c.cur + len / 2, 0, len / 8);
+        iterations = iterations_for(sizes[s].width * c.height);
+        t = time_runs(damage_from_compare, &c, iterations);
+        result("damage", "compare/band", sizes[s].width, c.height,
+               iterations, t, 1, "frames/s");
+
+        free(c.map);
+        free(c.prev);
+        free(c.cur);
+    }
+}
+
+#ifdef BENCH_CAIRO
+/* Painting a frame slot the way expose_event does, into an image surface
+   standing in for the window */
+
+struct paint_case {
+    cairo_surface_t *src, *dst;
+    int width, height;
+    int rows;
+};
+
+static void paint(void *arg)
+{
+    struct paint_case *c = arg;
+    cairo_t *cr = cairo_create(c->dst);
+
+    cairo_rectangle(cr, 0, (c->height - c->rows) / 2, c->width, c->rows);
+    cairo_clip(cr);
+    cairo_set_source_surface(cr, c->src, 0, 0);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_flush(c->dst);
+}
+
+static void bench_paint(void)
+{
+    int s;
+
+    for (s = 0; s < NSIZES; s++) {
+        struct paint_case c;
+        int iterations = iterations_for(sizes[s].width * sizes[s].height);
+        struct timing t;
+
+        c.width = sizes[s].width;
+        c.height = sizes[s].height;
+        c.src = cairo_image_surface_create(CAIRO_FORMAT_RGB24, c.width,
+                                           c.height);
+        c.dst = cairo_image_surface_create(CAIRO_FORMAT_RGB24, c.width,
+                                           c.height);
+
+        c.rows = c.height;
+        t = time_runs(paint, &c, iterations);
+        result("paint", "image/full", c.width, c.height, iterations, t,
+               (double)c.width * c.rows / 1e6, "Mpix/s");
+
+        c.rows = c.height / 8;
+        t = time_runs(paint, &c, iterations);
+        result("paint", "image/eighth", c.width, c.height, iterations, t,
+               (double)c.width * c.rows / 1e6, "Mpix/s");
+
+        cairo_surface_destroy(c.src);
+        cairo_surface_destroy(c.dst);
+    }
+}
+#endif
+
+/* Input injection through the injector thread into a pipe standing in for
+   the evdev node */
+
+static unsigned long long injected_bytes;
+
+static void *drain(void *ptr)
+{
+    int fd = *(int *)ptr;
+    char buf[65536];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+        if (n > 0) {
+            __atomic_add_fetch(&injected_bytes, n, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+static void bench_inject(void)
+{
+    struct inject_stats stats;
+    struct timing t;
+    unsigned long long bytes, last;
+    unsigned long calls = 0;
+    double start, end, calls_done;
+    pthread_t thread;
+    int fds[2], g, m;
+
+    if (pipe(fds) < 0 ||
+        pthread_create(&thread, NULL, drain, &fds[0]) ||
+        inject_init(fds[1], 0, 0, INJECT_MAX_CONTACTS) < 0) {
+        fprintf(stderr, "Failed to set up input injection\n");
+        return;
+    }
+
+    start = now();
+    for (g = 0; g < INJECT_GESTURES; g++) {
+        inject_touch(1, g % 640, 100);
+        for (m = 1; m <= INJECT_MOVES; m++) {
+            inject_motion(g % 640, 100 + m);
+        }
+        inject_touch(0, g % 640, 100 + INJECT_MOVES);
+        calls += INJECT_MOVES + 2;
+
+        /* Measure what the injector keeps up with, not the queue */
+        while (1) {
+            inject_get_stats(&stats);
+            if (calls - stats.events - stats.coalesced - stats.dropped <=
+                INJECT_IN_FLIGHT) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+    calls_done = now();
+
+    /* Done once the pipe has gone quiet */
+    last = __atomic_load_n(&injected_bytes, __ATOMIC_RELAXED);
+    do {
+        end = now();
+        usleep(10000);
+        bytes = last;
+        last = __atomic_load_n(&injected_bytes, __ATOMIC_RELAXED);
+    } while (last != bytes);
+
+    inject_get_stats(&stats);
+
+    t.median = t.min = (calls_done - start) / INJECT_GESTURES;
+    result("inject", "calls", 0, 0, INJECT_GESTURES, t,
+           INJECT_MOVES + 2, "calls/s");
+
+    t.median = t.min = (end - start) / INJECT_GESTURES;
+    result("inject", "events", 0, 0, INJECT_GESTURES, t,
+           (double)bytes / sizeof(struct input_event) / INJECT_GESTURES,
+           "events/s");
+
+    fprintf(out, ",\n    {\"group\": \"inject\", \"name\": \"stats\", "
+            "\"events\": %lu, \"batches\": %lu, \"dropped\": %lu, "
+            "\"coalesced\": %lu, \"max_depth\": %u, "
+            "\"latency_avg_us\": %.3f, \"latency_max_us\": %.3f}",
+            stats.events, stats.batches, stats.dropped, stats.coalesced,
+            stats.max_depth, stats.latency_avg_us, stats.latency_max_us);
+}
+
+int main(int argc, char *argv[])
+{
+    int failed;
+
+    if (argc == 3 && !strcmp(argv[1], "-o")) {
+        if ((out = fopen(argv[2], "w")) == NULL) {
+            fprintf(stderr, "Failed to open %s, %s\n", argv[2],
+                    strerror(errno));
+            return -1;
+        }
+    } else if (argc == 1) {
+        out = stdout;
+    } else {
+        fprintf(stderr, "Usage: %s [-o file.json]\n", argv[0]);
+        return -1;
+    }
+
+    srand(SEED);
+
+    fprintf(out, "{\n  \"isa\": \"%s\", \"repeats\": %d, \"seed\": %d,\n"
+            "  \"results\": [", convert_isa_name(convert_best_isa()),
+            REPEATS, SEED);
+
+    bench_copy();
+    failed = bench_convert();
+    bench_damage();
+#ifdef BENCH_CAIRO
+    bench_paint();
+#endif
+    bench_inject();
+
+    fprintf(out, "\n  ],\n  \"failed\": %s\n}\n", failed ? "true" : "false");
+    fclose(out);
+
+    return failed;
+}
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <linux/fb.h>
+#include <linux/vfb.h>
+
+#include "capture.h"
+#include "fbsource.h"
+#include "hist.h"
+#include "stats.h"
+
+/* How long to wait for a flip before polling for in-place damage */
+#define FRAME_TIMEOUT_MS 33
+
+#define PROBE_TIMEOUT_NS 1000000000ULL /* nothing changed, forget it */
+
+/* Framebuffer */
+static struct fbsource   source;
+unsigned char*           bits;
+int                      bpp;    /* byte per pixel */
+int                      stride; /* size of stride in pixel */
+struct fb_var_screeninfo vi;
+struct fb_fix_screeninfo fi;
+enum pixel_format        format;
+static convert_func      convert;
+
+/* Damage tracking */
+static unsigned char *damage_map;
+static size_t damage_map_len;
+
+static struct vfb_status *status; /* NULL if the source has none */
+
+struct frame frames[3];
+struct triplebuf frame_slots;
+int frame_eventfd = -1;
+static unsigned char *stale_rows[3]; /* rows each slot is behind on, only
+                                        touched by the capture thread */
+
+static int copy;
+static int block;
+static int release_eventfd = -1;  /* signalled for every frame taken */
+
+static uint64_t probe_input;      /* set by the consumer, taken on capture */
+
+/* Fetch the pages written since the last call from the source. Returns
+   the number of damaged pages, or -1 if damage tracking is unavailable and
+   everything has to be refreshed. */
+static int fetch_damage(void)
+{
+    unsigned long page_size = sysconf(_SC_PAGESIZE);
+
+    if (damage_map == NULL) {
+        damage_map_len = ((fi.smem_len + page_size - 1) / page_size + 7) / 8;
+        damage_map = malloc(damage_map_len);
+    }
+
+    return source.fetch_damage(&source, damage_map, damage_map_len);
+}
+
+int damage_bands(const unsigned char *map, unsigned long start, int rows,
+                 int line_length, struct damage_band *bands, int max_bands)
+{
+    unsigned long page_size = sysconf(_SC_PAGESIZE);
+    unsigned long end = start + rows*line_length;
+    unsigned long page;
+    int n = 0;
+
+    for (page = start / page_size; page * page_size < end; page++) {
+        int y1, y2;
+
+        if (!(map[page >> 3] & (1 << (page & 7)))) {
+            continue;
+        }
+
+        y1 = (page*page_size <= start) ? 0 :
+             (page*page_size - start) / line_length;
+        y2 = ((page + 1)*page_size - start + line_length - 1) / line_length;
+        if (y2 > rows) {
+            y2 = rows;
+        }
+
+        /* Merge with the previous band if adjacent, or if we ran out */
+        if (n > 0 && (y1 <= bands[n - 1].y2 || n == max_bands)) {
+            bands[n - 1].y2 = y2;
+        } else {
+            bands[n].y1 = y1;
+            bands[n].y2 = y2;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/* Without the vfb status page this falls back to the last
+   FBIOGET_VSCREENINFO result */
+unsigned int front_begin(unsigned long *offset)
+{
+    unsigned int seq = 0;
+    __u32 xoffset = vi.xoffset, yoffset = vi.yoffset;
+
+    if (status != NULL) {
+        while ((seq = __atomic_load_n(&status->seq, __ATOMIC_ACQUIRE)) & 1) {
+            sched_yield(); /* a flip is being published */
+        }
+        xoffset = __atomic_load_n(&status->xoffset, __ATOMIC_RELAXED);
+        yoffset = __atomic_load_n(&status->yoffset, __ATOMIC_RELAXED);
+    }
+
+    *offset = (xoffset + yoffset*vi.xres_virtual)*bpp;
+    return seq;
+}
+
+int front_retry(unsigned int seq)
+{
+    if (status == NULL) {
+        return 0;
+    }
+
+    /* Order the reads of the offsets and the front buffer before the
+       re-check, like smp_rmb() in read_seqretry() */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&status->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/* Add rows [y1, y2) to the damage carried by a frame */
+static void frame_add_band(struct frame *f, int y1, int y2)
+{
+    int i;
+
+    for (i = 0; i < f->nbands; i++) {
+        if (y1 <= f->bands[i].y2 && y2 >= f->bands[i].y1) {
+            break;
+        }
+    }
+
+    if (i == f->nbands) {
+        if (f->nbands < MAX_DAMAGE_BANDS) {
+            f->bands[f->nbands].y1 = y1;
+            f->bands[f->nbands].y2 = y2;
+            f->nbands++;
+            return;
+        }
+        i = f->nbands - 1; /* out of bands, grow the last one */
+    }
+
+    if (y1 < f->bands[i].y1) {
+        f->bands[i].y1 = y1;
+    }
+    if (y2 > f->bands[i].y2) {
+        f->bands[i].y2 = y2;
+    }
+}
+
+/* Bring the rows the back slot is behind on up to date from the front
+   buffer at byte offset front */
+static void update_back_slot(unsigned long front)
+{
+    int slot = frame_slots.back;
+    unsigned char *stale = stale_rows[slot];
+    uint32_t *pixels = frames[slot].pixels;
+    int y1, y2;
+
+    for (y1 = 0; y1 < vi.yres; y1 = y2) {
+        if (!stale[y1]) {
+            y2 = y1 + 1;
+            continue;
+        }
+        for (y2 = y1 + 1; y2 < vi.yres && stale[y2]; y2++);
+
+        convert_rows(convert, pixels + y1*vi.xres, vi.xres*4,
+                     bits + front + y1*fi.line_length, fi.line_length,
+                     vi.xres, y2 - y1);
+        memset(stale + y1, 0, y2 - y1);
+    }
+}
+
+static void *capture_thread(void *ptr)
+{
+    unsigned int frame = 0;
+    unsigned long shown = ULONG_MAX; /* offset of the buffer on screen */
+
+    while (1) {
+        struct damage_band bands[MAX_DAMAGE_BANDS];
+        struct frame *f;
+        unsigned long front;
+        unsigned int seq;
+        int ndamaged, nbands, raced = 0, unread, i, j;
+        uint64_t start = hist_now(), now;
+
+        if (source.wait_frame(&source, &frame, FRAME_TIMEOUT_MS) &&
+            status == NULL) {
+            struct fb_var_screeninfo pan;
+
+            /* No status page, ask where the new front buffer is. Only the
+               offsets, the frame slots are sized for the startup mode. */
+            if (0 > source.get_var(&source, &pan)) {
+                printf("Failed to get variable info\n");
+            } else {
+                vi.xoffset = pan.xoffset;
+                vi.yoffset = pan.yoffset;
+            }
+        }
+
+        now = hist_now();
+        stats_add(STAGE_WAIT, now - start);
+        start = now;
+
+        ndamaged = fetch_damage();
+
+        now = hist_now();
+        stats_add(STAGE_DAMAGE, now - start);
+        start = now;
+
+        /* Copy from whatever buffer is on screen right now, and go again
+           if the producer flips while we are copying */
+        while (1) {
+            seq = front_begin(&front);
+
+            if (front != shown || ndamaged < 0 || raced) {
+                /* The other buffer, everything may differ */
+                bands[0].y1 = 0;
+                bands[0].y2 = vi.yres;
+                nbands = 1;
+            } else if (ndamaged == 0) {
+                nbands = 0;
+            } else {
+                nbands = damage_bands(damage_map, front, vi.yres,
+                                      fi.line_length, bands,
+                                      MAX_DAMAGE_BANDS);
+            }
+
+            /* The consumer reads the front buffer itself */
+            if (!copy) {
+                break;
+            }
+
+            /* All three slots are behind on the damaged rows now */
+            for (i = 0; i < 3; i++) {
+                for (j = 0; j < nbands; j++) {
+                    memset(stale_rows[i] + bands[j].y1, 1,
+                           bands[j].y2 - bands[j].y1);
+                }
+            }
+            update_back_slot(front);
+
+            if (!front_retry(seq)) {
+                break;
+            }
+            raced = 1;
+        }
+        shown = front;
+
+        /* Nothing written since the last frame, nothing to do */
+        if (nbands == 0) {
+            continue;
+        }
+
+        now = hist_now();
+        stats_add(STAGE_CONVERT, now - start);
+        start = now;
+
+        f = &frames[frame_slots.back];
+        f->nbands = 0;
+        for (i = 0; i < nbands; i++) {
+            frame_add_band(f, bands[i].y1, bands[i].y2);
+        }
+
+        f->probe_input = __atomic_exchange_n(&probe_input, 0,
+                                             __ATOMIC_ACQ_REL);
+        if (f->probe_input) {
+            f->probe_fb = hist_now();
+        }
+
+        /* Wait for the consumer to take the previous frame */
+        while (block && triplebuf_pending(&frame_slots)) {
+            eventfd_t count;
+
+            eventfd_read(release_eventfd, &count);
+        }
+
+        /* If the consumer hasn't taken the previous frame yet it never
+           will, so its damage has to be repainted with this one */
+        if (0 <= (unread = triplebuf_unread(&frame_slots))) {
+            struct frame *prev = &frames[unread];
+
+            for (i = 0; i < prev->nbands; i++) {
+                frame_add_band(f, prev->bands[i].y1, prev->bands[i].y2);
+            }
+
+            /* The consumer may take it after all, and the probe with it.
+               Whichever of us swaps the probe out first has it. */
+            if (!f->probe_input &&
+                (f->probe_input = __atomic_exchange_n(&prev->probe_input, 0,
+                                                      __ATOMIC_RELAXED))) {
+                f->probe_fb = prev->probe_fb;
+            }
+        }
+
+        if (triplebuf_publish(&frame_slots)) {
+            stats_count(COUNTER_DROPPED);
+        }
+        eventfd_write(frame_eventfd, 1);
+
+        stats_count(COUNTER_FRAMES);
+        stats_add(STAGE_PUBLISH, hist_now() - start);
+    }
+
+    return NULL;
+}
+
+
+int capture_open(const char *spec)
+{
+    if (fbsource_open(&source, spec) < 0) {
+        return -1;
+    }
+    bits = source.bits;
+    vi = source.vi;
+    fi = source.fi;
+    status = source.status;
+
+    printf("Framebuffer resolution: %d x %d\n", vi.xres, vi.yres);
+
+    /* Calculate useful information */
+    bpp = vi.bits_per_pixel >> 3;
+    stride = fi.line_length / bpp;
+
+    format = pixel_format_from_var(&vi);
+    convert = convert_select(format);
+    if (convert == NULL) {
+        printf("Unsupported framebuffer format: %d bpp, red %d/%d, "
+               "green %d/%d, blue %d/%d\n", vi.bits_per_pixel,
+               vi.red.offset, vi.red.length, vi.green.offset,
+               vi.green.length, vi.blue.offset, vi.blue.length);
+        return -1;
+    }
+    printf("Framebuffer format: %s, converting with %s\n",
+           pixel_format_name(format), convert_isa_name(convert_best_isa()));
+
+    return 0;
+}
+
+int capture_start(int copy_frames, int block_on_consumer)
+{
+    pthread_t thread;
+    int i;
+
+    copy = copy_frames;
+    block = block_on_consumer;
+
+    /* The capture thread only ever touches the back slot and the
+       consumer the front one, so neither needs a lock */
+    triplebuf_init(&frame_slots);
+    for (i = 0; i < 3; i++) {
+        stale_rows[i] = malloc(vi.yres);
+        memset(stale_rows[i], 1, vi.yres);
+
+        if (copy) {
+            frames[i].pixels = calloc(vi.xres * vi.yres, 4);
+        }
+    }
+
+    if (0 > (frame_eventfd = eventfd(0, EFD_NONBLOCK)) ||
+        0 > (release_eventfd = eventfd(0, 0))) {
+        printf("Failed to create frame eventfd, %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (pthread_create(&thread, NULL, capture_thread, NULL)) {
+        printf("Failed to create capture thread\n");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+struct frame *capture_acquire(void)
+{
+    if (!triplebuf_acquire(&frame_slots)) {
+        return NULL;
+    }
+
+    if (block) {
+        eventfd_write(release_eventfd, 1);
+    }
+    stats_count(COUNTER_PRESENTED);
+    return &frames[frame_slots.front];
+}
+
+void capture_probe(uint64_t now)
+{
+    uint64_t old = __atomic_load_n(&probe_input, __ATOMIC_RELAXED);
+
+    if (old && now - old < PROBE_TIMEOUT_NS) {
+        return;
+    }
+    __atomic_compare_exchange_n(&probe_input, &old, now, 0,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Framebuffer capture. A thread waits for vfb to flip or damage the front
+ * buffer, converts what changed to XRGB8888 and publishes it through a
+ * triple buffer, waking the consumer through an eventfd. The consumer is
+ * either the GTK main loop or the headless writer.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <linux/fb.h>
+
+#include "convert.h"
+#include "triplebuf.h"
+
+#define MAX_DAMAGE_BANDS 16
+
+struct damage_band {
+    int y1, y2; /* rows [y1, y2) of the visible screen */
+};
+
+/* Frames handed from the capture thread to the consumer */
+struct frame {
+    uint32_t *pixels;           /* XRGB8888, NULL if not copying */
+    struct damage_band bands[MAX_DAMAGE_BANDS]; /* changed since the frame
+                                                   presented before */
+    int nbands;
+    uint64_t probe_input;       /* latency probe carried, 0 if none */
+    uint64_t probe_fb;
+};
+
+/* Framebuffer, valid after capture_open() */
+extern unsigned char *bits;
+extern int bpp;     /* byte per pixel */
+extern int stride;  /* size of stride in pixel */
+extern struct fb_var_screeninfo vi;
+extern struct fb_fix_screeninfo fi;
+extern enum pixel_format format;
+
+extern struct frame frames[3];
+extern struct triplebuf frame_slots;
+extern int frame_eventfd;   /* signalled for every published frame */
+
+/* Open the framebuffer source, see fbsource_open() for spec, and pick a
+   converter for its format */
+int capture_open(const char *spec);
+
+/* Start the capture thread. Without copy only the damage is published and
+   the consumer reads the front buffer itself. With block the capture
+   thread waits for the consumer to take each frame instead of replacing
+   frames it hasn't taken yet. */
+int capture_start(int copy, int block);
+
+/* Consumer: take the newest published frame, NULL if there is none */
+struct frame *capture_acquire(void);
+
+/* Hand a latency probe taken at time now to the next frame that changes.
+   One is in flight at a time, a waiting probe wins until it times out. */
+void capture_probe(uint64_t now);
+
+/* Turn the damaged pages in the page bitmap map, for the rows of the
+   buffer starting at byte offset start, into row bands. Returns the
+   number of bands. */
+int damage_bands(const unsigned char *map, unsigned long start, int rows,
+                 int line_length, struct damage_band *bands, int max_bands);
+
+/* Sample the position of the buffer on screen. Returns a sequence number
+   for front_retry(). */
+unsigned int front_begin(unsigned long *offset);
+
+/* Returns non-zero if the display flipped since front_begin(), in which
+   case whatever was read from the front buffer may be torn. */
+int front_retry(unsigned int seq);
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Pixel format conversion kernels. Every format has a scalar version;
+ * on x86 there are SSE2 and AVX2 versions as well, compiled with target
+ * attributes and picked at runtime, so the binary still runs on any CPU.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "convert.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#define CONVERT_X86
+#include <immintrin.h>
+
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define ALPHA 0xff000000
+
+/*
+ * Scalar kernels
+ */
+
+static inline uint32_t expand565(unsigned int r, unsigned int g,
+                                 unsigned int b)
+{
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+    return ALPHA | (r << 16) | (g << 8) | b;
+}
+
+static void rgb565_scalar(uint32_t *dst, const uint8_t *src, int n)
+{
+    const uint16_t *s = (const uint16_t *)src;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = expand565(s[i] >> 11, (s[i] >> 5) & 0x3f, s[i] & 0x1f);
+    }
+}
+
+static void bgr565_scalar(uint32_t *dst, const uint8_t *src, int n)
+{
+    const uint16_t *s = (const uint16_t *)src;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = expand565(s[i] & 0x1f, (s[i] >> 5) & 0x3f, s[i] >> 11);
+    }
+}
+
+static void rgb888_scalar(uint32_t *dst, const uint8_t *src, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++, src += 3) {
+        dst[i] = ALPHA | (src[2] << 16) | (src[1] << 8) | src[0];
+    }
+}
+
+static void bgr888_scalar(uint32_t *dst, const uint8_t *src, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++, src += 3) {
+        dst[i] = ALPHA | (src[0] << 16) | (src[1] << 8) | src[2];
+    }
+}
+
+/* Already what cairo wants, nothing beats a plain copy */
+static void xrgb8888_copy(uint32_t *dst, const uint8_t *src, int n)
+{
+    memcpy(dst, src, n * 4);
+}
+
+static void xbgr8888_scalar(uint32_t *dst, const uint8_t *src, int n)
+{
+    const uint32_t *s = (const uint32_t *)src;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = ALPHA | (s[i] & 0xff00) |
+                 ((s[i] & 0xff) << 16) | ((s[i] >> 16) & 0xff);
+    }
+}
+
+#ifdef CONVERT_X86
+
+/*
+ * SSE2 kernels
+ */
+
+static TARGET_SSE2 __m128i swap_rb_sse2(__m128i p)
+{
+    const __m128i mask_g = _mm_set1_epi32(0x0000ff00);
+    const __m128i mask_c = _mm_set1_epi32(0x000000ff);
+
+    return _mm_or_si128(_mm_and_si128(p, mask_g),
+           _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), mask_c),
+                        _mm_slli_epi32(_mm_and_si128(p, mask_c), 16)));
+}
+
+static TARGET_SSE2 void convert565_sse2(uint32_t *dst, const uint8_t *src,
+                                        int n, int bgr)
+{
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mask6 = _mm_set1_epi16(0x3f);
+    const __m128i alpha = _mm_set1_epi16((short)0xff00);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(src + i * 2));
+        __m128i hi = _mm_srli_epi16(p, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask6);
+        __m128i lo = _mm_and_si128(p, mask5);
+        __m128i gb, ar;
+
+        hi = _mm_or_si128(_mm_slli_epi16(hi, 3), _mm_srli_epi16(hi, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+        lo = _mm_or_si128(_mm_slli_epi16(lo, 3), _mm_srli_epi16(lo, 2));
+
+        /* 16 bit halves of the output pixels: A R and G B */
+        gb = _mm_or_si128(_mm_slli_epi16(g, 8), bgr ? hi : lo);
+        ar = _mm_or_si128(alpha, bgr ? lo : hi);
+
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(gb, ar));
+        _mm_storeu_si128((__m128i *)(dst + i + 4),
+                         _mm_unpackhi_epi16(gb, ar));
+    }
+
+    if (bgr) {
+        bgr565_scalar(dst + i, src + i * 2, n - i);
+    } else {
+        rgb565_scalar(dst + i, src + i * 2, n - i);
+    }
+}
+
+static TARGET_SSE2 void rgb565_sse2(uint32_t *dst, const uint8_t *src, int n)
+{
+    convert565_sse2(dst, src, n, 0);
+}
+
+static TARGET_SSE2 void bgr565_sse2(uint32_t *dst, const uint8_t *src, int n)
+{
+    convert565_sse2(dst, src, n, 1);
+}
+
+/* SSE2 has no byte shuffle, so gather the four 3 byte pixels of a 12 byte
+   group with byte shifts instead */
+static TARGET_SSE2 void convert888_sse2(uint32_t *dst, const uint8_t *src,
+                                        int n, int bgr)
+{
+    const __m128i mask = _mm_set1_epi32(0x00ffffff);
+    const __m128i alpha = _mm_set1_epi32(ALPHA);
+    int i;
+
+    /* Each load reads 16 bytes, stop while 2 pixels of slack are left */
+    for (i = 0; i + 6 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        __m128i p01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+        __m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6),
+                                         _mm_srli_si128(v, 9));
+        __m128i p = _mm_and_si128(_mm_unpacklo_epi64(p01, p23), mask);
+
+        if (bgr) {
+            p = swap_rb_sse2(p);
+        }
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(p, alpha));
+    }
+
+    if (bgr) {
+        bgr888_scalar(dst + i, src + i * 3, n - i);
+    } else {
+        rgb888_scalar(dst + i, src + i * 3, n - i);
+    }
+}
+
+static TARGET_SSE2 void rgb888_sse2(uint32_t *dst, const uint8_t *src, int n)
+{
+    convert888_sse2(dst, src, n, 0);
+}
+
+static TARGET_SSE2 void bgr888_sse2(uint32_t *dst, const uint8_t *src, int n)
+{
+    convert888_sse2(dst, src, n, 1);
+}
+
+static TARGET_SSE2 void xbgr8888_sse2(uint32_t *dst, const uint8_t *src,
+                                      int n)
+{
+    const __m128i alpha = _mm_set1_epi32(ALPHA);
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i p = _mm_loadu_si128((const __m128i *)(src + i * 4));
+
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_or_si128(swap_rb_sse2(p), alpha));
+    }
+
+    xbgr8888_scalar(dst + i, src + i * 4, n - i);
+}
+
+/*
+ * AVX2 kernels
+ */
+
+static TARGET_AVX2 void convert565_avx2(uint32_t *dst, const uint8_t *src,
+                                        int n, int bgr)
+{
+    const __m256i mask5 = _mm256_set1_epi16(0x1f);
+    const __m256i mask6 = _mm256_set1_epi16(0x3f);
+    const __m256i alpha = _mm256_set1_epi16((short)0xff00);
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(src + i * 2));
+        __m256i hi = _mm256_srli_epi16(p, 11);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi16(p, 5), mask6);
+        __m256i lo = _mm256_and_si256(p, mask5);
+        __m256i gb, ar, p0, p1;
+
+        hi = _mm256_or_si256(_mm256_slli_epi16(hi, 3),
+                             _mm256_srli_epi16(hi, 2));
+        g = _mm256_or_si256(_mm256_slli_epi16(g, 2),
+                            _mm256_srli_epi16(g, 4));
+        lo = _mm256_or_si256(_mm256_slli_epi16(lo, 3),
+                             _mm256_srli_epi16(lo, 2));
+
+        gb = _mm256_or_si256(_mm256_slli_epi16(g, 8), bgr ? hi : lo);
+        ar = _mm256_or_si256(alpha, bgr ? lo : hi);
+
+        /* Unpacking works per 128 bit lane: p0 holds pixels 0-3 and 8-11,
+           p1 pixels 4-7 and 12-15 */
+        p0 = _mm256_unpacklo_epi16(gb, ar);
+        p1 = _mm256_unpackhi_epi16(gb, ar);
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + i + 8),
+                            _mm256_permute2x128_si256(p0, p1, 0x31));
+    }
+
+    if (bgr) {
+        bgr565_scalar(dst + i, src + i * 2, n - i);
+    } else {
+        rgb565_scalar(dst + i, src + i * 2, n - i);
+    }
+}
+
+static TARGET_AVX2 void rgb565_avx2(uint32_t *dst, const uint8_t *src, int n)
+{
+    convert565_avx2(dst, src, n, 0);
+}
+
+static TARGET_AVX2 void bgr565_avx2(uint32_t *dst, const uint8_t *src, int n)
+{
+    convert565_avx2(dst, src, n, 1);
+}
+
+static TARGET_AVX2 void convert888_avx2(uint32_t *dst, const uint8_t *src,
+                                        int n, int bgr)
+{
+    const __m256i shuffle_rgb = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i shuffle_bgr = _mm256_setr_epi8(
+        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m256i alpha = _mm256_set1_epi32(ALPHA);
+    int i;
+
+    /* 12 bytes of input per lane, each read as 16: stop while 2 pixels of
+       slack are left after the second load */
+    for (i = 0; i + 10 <= n; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(src + i * 3 + 12));
+        __m256i p = _mm256_inserti128_si256(_mm256_castsi128_si256(lo),
+                                            hi, 1);
+
+        p = _mm256_shuffle_epi8(p, bgr ? shuffle_bgr : shuffle_rgb);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(p, alpha));
+    }
+
+    if (bgr) {
+        bgr888_scalar(dst + i, src + i * 3, n - i);
+    } else {
+        rgb888_scalar(dst + i, src + i * 3, n - i);
+    }
+}
+
+static TARGET_AVX2 void rgb888_avx2(uint32_t *dst, const uint8_t *src, int n)
+{
+    convert888_avx2(dst, src, n, 0);
+}
+
+static TARGET_AVX2 void bgr888_avx2(uint32_t *dst, const uint8_t *src, int n)
+{
+    convert888_avx2(dst, src, n, 1);
+}
+
+static TARGET_AVX2 void xbgr8888_avx2(uint32_t *dst, const uint8_t *src,
+                                      int n)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m256i alpha = _mm256_set1_epi32(ALPHA);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i p = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+
+        p = _mm256_shuffle_epi8(p, shuffle);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(p, alpha));
+    }
+
+    xbgr8888_scalar(dst + i, src + i * 4, n - i);
+}
+
+#define KERNELS(name) { name##_scalar, name##_sse2, name##_avx2 }
+#else
+#define KERNELS(name) { name##_scalar, NULL, NULL }
+#endif /* CONVERT_X86 */
+
+static const convert_func kernels[PIXEL_FORMAT_COUNT][CONVERT_ISA_COUNT] = {
+    [PIXEL_FORMAT_RGB565]   = KERNELS(rgb565),
+    [PIXEL_FORMAT_BGR565]   = KERNELS(bgr565),
+    [PIXEL_FORMAT_RGB888]   = KERNELS(rgb888),
+    [PIXEL_FORMAT_BGR888]   = KERNELS(bgr888),
+    [PIXEL_FORMAT_XRGB8888] = { xrgb8888_copy, xrgb8888_copy, xrgb8888_copy },
+    [PIXEL_FORMAT_XBGR8888] = KERNELS(xbgr8888),
+};
+
+static const char *format_names[PIXEL_FORMAT_COUNT] = {
+    [PIXEL_FORMAT_UNKNOWN]  = "unknown",
+    [PIXEL_FORMAT_RGB565]   = "RGB565",
+    [PIXEL_FORMAT_BGR565]   = "BGR565",
+    [PIXEL_FORMAT_RGB888]   = "RGB888",
+    [PIXEL_FORMAT_BGR888]   = "BGR888",
+    [PIXEL_FORMAT_XRGB8888] = "XRGB8888",
+    [PIXEL_FORMAT_XBGR8888] = "XBGR8888",
+};
+
+static const char *isa_names[CONVERT_ISA_COUNT] = {
+    [CONVERT_SCALAR] = "scalar",
+    [CONVERT_SSE2]   = "sse2",
+    [CONVERT_AVX2]   = "avx2",
+};
+
+static int is_field(const struct fb_bitfield *field, unsigned int offset,
+                    unsigned int length)
+{
+    return field->offset == offset && field->length == length;
+}
+
+enum pixel_format pixel_format_from_var(const struct fb_var_screeninfo *vi)
+{
+    switch (vi->bits_per_pixel) {
+    case 16:
+        if (is_field(&vi->green, 5, 6)) {
+            if (is_field(&vi->red, 11, 5) && is_field(&vi->blue, 0, 5)) {
+                return PIXEL_FORMAT_RGB565;
+            }
+            if (is_field(&vi->red, 0, 5) && is_field(&vi->blue, 11, 5)) {
+                return PIXEL_FORMAT_BGR565;
+            }
+        }
+        break;
+    case 24:
+    case 32:
+        if (is_field(&vi->green, 8, 8)) {
+            if (is_field(&vi->red, 16, 8) && is_field(&vi->blue, 0, 8)) {
+                return vi->bits_per_pixel == 24 ? PIXEL_FORMAT_RGB888
+                                                : PIXEL_FORMAT_XRGB8888;
+            }
+            if (is_field(&vi->red, 0, 8) && is_field(&vi->blue, 16, 8)) {
+                return vi->bits_per_pixel == 24 ? PIXEL_FORMAT_BGR888
+                                                : PIXEL_FORMAT_XBGR8888;
+            }
+        }
+        break;
+    }
+
+    return PIXEL_FORMAT_UNKNOWN;
+}
+
+const char *pixel_format_name(enum pixel_format format)
+{
+    if (format >= PIXEL_FORMAT_COUNT) {
+        format = PIXEL_FORMAT_UNKNOWN;
+    }
+    return format_names[format];
+}
+
+int pixel_format_bytes(enum pixel_format format)
+{
+    switch (format) {
+    case PIXEL_FORMAT_RGB565:
+    case PIXEL_FORMAT_BGR565:
+        return 2;
+    case PIXEL_FORMAT_RGB888:
+    case PIXEL_FORMAT_BGR888:
+        return 3;
+    case PIXEL_FORMAT_XRGB8888:
+    case PIXEL_FORMAT_XBGR8888:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+enum convert_isa convert_best_isa(void)
+{
+#ifdef CONVERT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return CONVERT_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return CONVERT_SSE2;
+    }
+#endif
+    return CONVERT_SCALAR;
+}
+
+const char *convert_isa_name(enum convert_isa isa)
+{
+    return isa < CONVERT_ISA_COUNT ? isa_names[isa] : "unknown";
+}
+
+convert_func convert_get(enum pixel_format format, enum convert_isa isa)
+{
+    if (format <= PIXEL_FORMAT_UNKNOWN || format >= PIXEL_FORMAT_COUNT ||
+        isa > convert_best_isa()) {
+        return NULL;
+    }
+    return kernels[format][isa];
+}
+
+convert_func convert_select(enum pixel_format format)
+{
+    return convert_get(format, convert_best_isa());
+}
+
+void convert_rows(convert_func convert, uint32_t *dst, int dst_stride,
+                  const uint8_t *src, int src_stride, int width, int rows)
+{
+    while (rows-- > 0) {
+        convert(dst, src, width);
+        dst = (uint32_t *)((uint8_t *)dst + dst_stride);
+        src += src_stride;
+    }
+}
+
+void convert_xrgb_to_i420(uint8_t *y, uint8_t *u, uint8_t *v,
+                          const uint32_t *src, int width, int height)
+{
+    int cw = (width + 1) / 2;
+    int row, col;
+
+    for (row = 0; row < height; row++) {
+        const uint32_t *p = src + row * width;
+
+        for (col = 0; col < width; col++) {
+            int r = (p[col] >> 16) & 0xff, g = (p[col] >> 8) & 0xff;
+            int b = p[col] & 0xff;
+
+            y[row * width + col] = (77*r + 150*g + 29*b + 128) >> 8;
+        }
+    }
+
+    for (row = 0; row < height; row += 2) {
+        const uint32_t *p0 = src + row * width;
+        const uint32_t *p1 = row + 1 < height ? p0 + width : p0;
+
+        for (col = 0; col < width; col += 2) {
+            int c1 = col + 1 < width ? col + 1 : col;
+            int r, g, b, cb, cr;
+
+            r = ((p0[col] >> 16) & 0xff) + ((p0[c1] >> 16) & 0xff) +
+                ((p1[col] >> 16) & 0xff) + ((p1[c1] >> 16) & 0xff);
+            g = ((p0[col] >> 8) & 0xff) + ((p0[c1] >> 8) & 0xff) +
+                ((p1[col] >> 8) & 0xff) + ((p1[c1] >> 8) & 0xff);
+            b = (p0[col] & 0xff) + (p0[c1] & 0xff) +
+                (p1[col] & 0xff) + (p1[c1] & 0xff);
+
+            /* Sums of four, hence the extra >> 2, offset to stay positive */
+            cb = (-43*r - 85*g + 128*b + (128 << 10) + 512) >> 10;
+            cr = (128*r - 107*g - 21*b + (128 << 10) + 512) >> 10;
+            u[row / 2 * cw + col / 2] = cb > 255 ? 255 : cb;
+            v[row / 2 * cw + col / 2] = cr > 255 ? 255 : cr;
+        }
+    }
+}
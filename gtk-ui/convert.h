@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Pixel format conversion from the framebuffer layout to XRGB8888, which
+ * is what cairo (CAIRO_FORMAT_RGB24) and X want.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdint.h>
+#include <linux/fb.h>
+
+/* Names give the components from the most to the least significant bits
+   of a pixel, the way fb_var_screeninfo describes them */
+enum pixel_format {
+    PIXEL_FORMAT_UNKNOWN = 0,
+    PIXEL_FORMAT_RGB565,   /* same as CAIRO_FORMAT_RGB16_565 */
+    PIXEL_FORMAT_BGR565,
+    PIXEL_FORMAT_RGB888,   /* 24 bpp, blue in the first byte */
+    PIXEL_FORMAT_BGR888,
+    PIXEL_FORMAT_XRGB8888, /* same as CAIRO_FORMAT_RGB24 */
+    PIXEL_FORMAT_XBGR8888,
+    PIXEL_FORMAT_COUNT
+};
+
+enum convert_isa {
+    CONVERT_SCALAR = 0,
+    CONVERT_SSE2,
+    CONVERT_AVX2,
+    CONVERT_ISA_COUNT
+};
+
+/* Convert n pixels from src to XRGB8888 in dst */
+typedef void (*convert_func)(uint32_t *dst, const uint8_t *src, int n);
+
+enum pixel_format pixel_format_from_var(const struct fb_var_screeninfo *vi);
+const char *pixel_format_name(enum pixel_format format);
+int pixel_format_bytes(enum pixel_format format);
+
+/* Best instruction set supported by the CPU we are running on */
+enum convert_isa convert_best_isa(void);
+const char *convert_isa_name(enum convert_isa isa);
+
+/* Kernel for a given format and instruction set, NULL if there is none or
+   the CPU can't run it */
+convert_func convert_get(enum pixel_format format, enum convert_isa isa);
+
+/* Fastest kernel for format on this CPU */
+convert_func convert_select(enum pixel_format format);
+
+/* Convert a block of rows, strides are in bytes */
+void convert_rows(convert_func convert, uint32_t *dst, int dst_stride,
+                  const uint8_t *src, int src_stride, int width, int rows);
+
+/* XRGB8888 to planar 4:2:0 YUV, full range BT.601 (Y4M's C420jpeg). The
+   chroma planes are (width + 1) / 2 by (height + 1) / 2, each sample the
+   average of a 2x2 block. */
+void convert_xrgb_to_i420(uint8_t *y, uint8_t *u, uint8_t *v,
+                          const uint32_t *src, int width, int height);
+
+#endif /* CONVERT_H */
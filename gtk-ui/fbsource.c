@@ -0,0 +1,583 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Other credits:
+ *  - Some FB related code from the fbvncserver project
+ *      Original at http://fbvncserver.sourceforge.net/
+ *      Modified by Danke Xie <danke.xie@gmail.com> at
+ *        http://code.google.com/p/fastdroid-vnc/
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fbsource.h"
+
+#define DEFAULT_FPS 60
+
+/* Synthetic pattern: a band of rows moving down over a gradient */
+#define BAND_ROWS 32
+#define BAND_STEP 4     /* rows per frame */
+
+static unsigned long page_align(unsigned long size)
+{
+    unsigned long page_size = sysconf(_SC_PAGESIZE);
+
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/* Framebuffer device */
+
+struct fbdev {
+    int fd;
+    int damage_supported;
+    int frame_eventfd;          /* signalled by vfb on every frame, -1 if
+                                   the kernel can't */
+    int vsync_supported;
+};
+
+static int fbdev_fetch_damage(struct fbsource *source, unsigned char *map,
+                              size_t len)
+{
+    struct fbdev *dev = source->priv;
+    struct vfb_damage damage;
+
+    if (!dev->damage_supported) {
+        return -1;
+    }
+
+    damage.bitmap = (unsigned long)map;
+    damage.len = len;
+    if (ioctl(dev->fd, VFBIO_GET_DAMAGE, &damage) < 0) {
+        printf("Damage tracking not available, %s\n", strerror(errno));
+        dev->damage_supported = 0;
+        return -1;
+    }
+
+    return damage.npages;
+}
+
+/* Falls back to plain polling on kernels without VFBIO_SET_FRAME_EVENTFD */
+static int fbdev_wait_frame(struct fbsource *source, unsigned int *seq,
+                            int timeout_ms)
+{
+    struct fbdev *dev = source->priv;
+
+    if (dev->frame_eventfd >= 0) {
+        struct pollfd pfd = { dev->frame_eventfd, POLLIN, 0 };
+        uint64_t count;
+
+        if (poll(&pfd, 1, timeout_ms ? timeout_ms : -1) <= 0 ||
+            read(dev->frame_eventfd, &count, sizeof(count)) < 0) {
+            return 0;
+        }
+        if (source->status) {
+            *seq = __atomic_load_n(&source->status->frame, __ATOMIC_ACQUIRE);
+        } else {
+            (*seq)++;
+        }
+        return 1;
+    }
+
+    /* Without frame events sample on the vblank if there is one, so at
+       least we run at the producer's pace. Either way a new frame might
+       be up. */
+    if (dev->vsync_supported) {
+        __u32 crtc = 0;
+
+        if (ioctl(dev->fd, FBIO_WAITFORVSYNC, &crtc) == 0 ||
+            errno == EINTR) {
+            return 1;
+        }
+        dev->vsync_supported = 0;
+    }
+
+    usleep(timeout_ms * 1000);
+    return 1;
+}
+
+static int fbdev_get_var(struct fbsource *source,
+                         struct fb_var_screeninfo *var)
+{
+    struct fbdev *dev = source->priv;
+
+    return ioctl(dev->fd, FBIOGET_VSCREENINFO, var);
+}
+
+static int fbdev_open(struct fbsource *source, const char *device)
+{
+    struct fbdev *dev = calloc(1, sizeof(*dev));
+
+    dev->damage_supported = 1;
+    dev->frame_eventfd = -1;
+    dev->vsync_supported = 1;
+
+    /* Open framebuffer */
+    if (0 > (dev->fd = open(device, O_RDWR))) {
+        printf("Failed to open %s, %s\n", device, strerror(errno));
+        return -1;
+    }
+
+    /* Get fixed information */
+    if(0 > ioctl(dev->fd, FBIOGET_FSCREENINFO, &source->fi)) {
+        printf("Failed to get fixed info\n");
+        return -1;
+    }
+
+    /* Get variable information */
+    if(0 > ioctl(dev->fd, FBIOGET_VSCREENINFO, &source->vi)) {
+        printf("Failed to get variable info\n");
+        return -1;
+    }
+
+    /* Get raw bits buffer */
+    if(MAP_FAILED == (source->bits = mmap(0, source->fi.smem_len,
+                      PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, 0))) {
+        printf("Failed to mmap fb\n");
+        return -1;
+    }
+
+    /* Get the front buffer status page that follows the video memory */
+    source->status = mmap(0, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+                          dev->fd, page_align(source->fi.smem_len));
+    if (source->status == MAP_FAILED) {
+        printf("No fb status page, frames may tear\n");
+        source->status = NULL;
+    }
+
+    /* Have vfb tell us about frames */
+    dev->frame_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (dev->frame_eventfd >= 0 &&
+        ioctl(dev->fd, VFBIO_SET_FRAME_EVENTFD, &dev->frame_eventfd) < 0) {
+        printf("Frame events not available, %s\n", strerror(errno));
+        close(dev->frame_eventfd);
+        dev->frame_eventfd = -1;
+    }
+
+    source->wait_frame = fbdev_wait_frame;
+    source->fetch_damage = fbdev_fetch_damage;
+    source->get_var = fbdev_get_var;
+    source->priv = dev;
+    return 0;
+}
+
+/* Video memory of our own, in a memfd, with a thread drawing into it at a
+   fixed rate and tracking damage and flips the way vfb does */
+
+struct memsource {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* broadcast for every new frame */
+    unsigned int frame;
+    unsigned char *damage;      /* pages written since the last fetch */
+    size_t damage_len;
+    int npages;
+    __u32 yoffset;              /* of the buffer on screen */
+
+    /* Only touched by the drawing thread */
+    void (*draw)(struct fbsource *source, unsigned char *buf);
+    int fps;
+    int inplace;                /* one buffer, drawn while on screen */
+    int back;
+    unsigned int tick;
+    int band;                   /* first row of the band on screen */
+    int fd;                     /* recording */
+    unsigned long nframes;
+};
+
+/* Record rows [y1, y2) of the buffer at buf as written */
+static void mem_damage_rows(struct fbsource *source, unsigned char *buf,
+                            int y1, int y2)
+{
+    struct memsource *mem = source->priv;
+    unsigned long page_size = sysconf(_SC_PAGESIZE);
+    unsigned long start = buf - source->bits + y1 * source->fi.line_length;
+    unsigned long end = buf - source->bits + y2 * source->fi.line_length;
+    unsigned long page;
+
+    pthread_mutex_lock(&mem->lock);
+    for (page = start / page_size; page * page_size < end; page++) {
+        if (!(mem->damage[page >> 3] & (1 << (page & 7)))) {
+            mem->damage[page >> 3] |= 1 << (page & 7);
+            mem->npages++;
+        }
+    }
+    pthread_mutex_unlock(&mem->lock);
+}
+
+static void *mem_producer(void *ptr)
+{
+    struct fbsource *source = ptr;
+    struct memsource *mem = source->priv;
+    struct vfb_status *status = source->status;
+    unsigned long buffer_size = source->vi.yres * source->fi.line_length;
+    long period = 1000000000L / mem->fps;
+    struct timespec tick;
+
+    clock_gettime(CLOCK_MONOTONIC, &tick);
+
+    while (1) {
+        unsigned char *buf = source->bits + mem->back * buffer_size;
+
+        tick.tv_nsec += period;
+        if (tick.tv_nsec >= 1000000000L) {
+            tick.tv_sec++;
+            tick.tv_nsec -= 1000000000L;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick,
+                               NULL) == EINTR);
+
+        mem->draw(source, buf);
+
+        pthread_mutex_lock(&mem->lock);
+        mem->frame++;
+        if (!mem->inplace) {
+            /* Flip, publishing the new offset like vfb's status page */
+            mem->yoffset = mem->back * source->vi.yres;
+            __atomic_store_n(&status->seq, status->seq + 1,
+                             __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            __atomic_store_n(&status->yoffset, mem->yoffset,
+                             __ATOMIC_RELAXED);
+            __atomic_store_n(&status->frame, mem->frame, __ATOMIC_RELAXED);
+            __atomic_store_n(&status->seq, status->seq + 1,
+                             __ATOMIC_RELEASE);
+            mem->back ^= 1;
+        }
+        pthread_cond_broadcast(&mem->cond);
+        pthread_mutex_unlock(&mem->lock);
+    }
+
+    return NULL;
+}
+
+static int mem_wait_frame(struct fbsource *source, unsigned int *seq,
+                          int timeout_ms)
+{
+    struct memsource *mem = source->priv;
+    struct timespec deadline;
+    int changed;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&mem->lock);
+    while (mem->frame == *seq &&
+           pthread_cond_timedwait(&mem->cond, &mem->lock, &deadline) == 0);
+    changed = mem->frame != *seq;
+    *seq = mem->frame;
+    pthread_mutex_unlock(&mem->lock);
+
+    return changed;
+}
+
+static int mem_fetch_damage(struct fbsource *source, unsigned char *map,
+                            size_t len)
+{
+    struct memsource *mem = source->priv;
+    int npages;
+
+    if (len > mem->damage_len) {
+        len = mem->damage_len;
+    }
+
+    pthread_mutex_lock(&mem->lock);
+    memcpy(map, mem->damage, len);
+    memset(mem->damage, 0, mem->damage_len);
+    npages = mem->npages;
+    mem->npages = 0;
+    pthread_mutex_unlock(&mem->lock);
+
+    return npages;
+}
+
+static int mem_get_var(struct fbsource *source,
+                       struct fb_var_screeninfo *var)
+{
+    struct memsource *mem = source->priv;
+
+    *var = source->vi;
+    pthread_mutex_lock(&mem->lock);
+    var->yoffset = mem->yoffset;
+    pthread_mutex_unlock(&mem->lock);
+    return 0;
+}
+
+static int mem_open(struct fbsource *source, int width, int height, int bpp,
+                    struct memsource *mem)
+{
+    struct fb_var_screeninfo *vi = &source->vi;
+    struct fb_fix_screeninfo *fi = &source->fi;
+    unsigned long page_size = sysconf(_SC_PAGESIZE);
+    pthread_condattr_t attr;
+    pthread_t thread;
+    int fd;
+
+    if (width <= 0 || height <= 0 || mem->fps <= 0) {
+        printf("Bad source mode %dx%d@%d\n", width, height, mem->fps);
+        return -1;
+    }
+
+    memset(vi, 0, sizeof(*vi));
+    vi->xres = vi->xres_virtual = width;
+    vi->yres = height;
+    vi->yres_virtual = mem->inplace ? height : height * 2;
+    vi->bits_per_pixel = bpp;
+    switch (bpp) {
+    case 16:
+        vi->red.offset = 11;
+        vi->red.length = 5;
+        vi->green.offset = 5;
+        vi->green.length = 6;
+        vi->blue.length = 5;
+        break;
+    case 24:
+    case 32:
+        vi->red.offset = 16;
+        vi->red.length = 8;
+        vi->green.offset = 8;
+        vi->green.length = 8;
+        vi->blue.length = 8;
+        break;
+    default:
+        printf("Unsupported source depth %d\n", bpp);
+        return -1;
+    }
+
+    memset(fi, 0, sizeof(*fi));
+    strncpy(fi->id, "memfd", sizeof(fi->id));
+    fi->line_length = width * (bpp / 8);
+    fi->smem_len = fi->line_length * vi->yres_virtual;
+
+    /* Video memory followed by the status page, like vfb lays it out */
+    if (0 > (fd = memfd_create("fbsource", MFD_CLOEXEC)) ||
+        0 > ftruncate(fd, page_align(fi->smem_len) + page_size)) {
+        printf("Failed to create memfd, %s\n", strerror(errno));
+        return -1;
+    }
+
+    source->bits = mmap(0, page_align(fi->smem_len) + page_size,
+                        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (source->bits == MAP_FAILED) {
+        printf("Failed to mmap memfd, %s\n", strerror(errno));
+        return -1;
+    }
+    source->status = (struct vfb_status *)
+                     (source->bits + page_align(fi->smem_len));
+
+    mem->damage_len = (page_align(fi->smem_len) / page_size + 7) / 8;
+    mem->damage = calloc(1, mem->damage_len);
+    mem->band = -1;
+    pthread_mutex_init(&mem->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&mem->cond, &attr);
+
+    source->wait_frame = mem_wait_frame;
+    source->fetch_damage = mem_fetch_damage;
+    source->get_var = mem_get_var;
+    source->priv = mem;
+
+    if (pthread_create(&thread, NULL, mem_producer, source)) {
+        printf("Failed to create source thread\n");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+/* WxH[xBPP][@FPS], returns what follows or NULL if it doesn't parse */
+static const char *parse_mode(const char *spec, int *width, int *height,
+                              int *bpp, int *fps)
+{
+    int n = 0;
+
+    if (sscanf(spec, "%dx%d%n", width, height, &n) < 2) {
+        return NULL;
+    }
+    spec += n;
+
+    if (bpp != NULL && *spec == 'x') {
+        if (sscanf(spec, "x%d%n", bpp, &n) < 1) {
+            return NULL;
+        }
+        spec += n;
+    }
+
+    if (*spec == '@') {
+        if (sscanf(spec, "@%d%n", fps, &n) < 1) {
+            return NULL;
+        }
+        spec += n;
+    }
+
+    return spec;
+}
+
+static void pack_pixel(const struct fb_var_screeninfo *vi, unsigned char *p,
+                       int r, int g, int b)
+{
+    uint32_t pixel = (r >> (8 - vi->red.length)) << vi->red.offset |
+                     (g >> (8 - vi->green.length)) << vi->green.offset |
+                     (b >> (8 - vi->blue.length)) << vi->blue.offset;
+    int i;
+
+    for (i = 0; i < vi->bits_per_pixel / 8; i++) {
+        p[i] = pixel >> (8 * i);
+    }
+}
+
+static void synthetic_row(struct fbsource *source, unsigned char *buf,
+                          int y, int band)
+{
+    struct memsource *mem = source->priv;
+    const struct fb_var_screeninfo *vi = &source->vi;
+    unsigned char *p = buf + y * source->fi.line_length;
+    int in_band = y >= band && y < band + BAND_ROWS;
+    int x;
+
+    for (x = 0; x < vi->xres; x++, p += vi->bits_per_pixel / 8) {
+        if (in_band) {
+            pack_pixel(vi, p, 255, 255 - x * 255 / vi->xres,
+                       mem->tick * 8 & 0xff);
+        } else {
+            pack_pixel(vi, p, x * 255 / vi->xres, y * 255 / vi->yres, 64);
+        }
+    }
+}
+
+static void synthetic_draw(struct fbsource *source, unsigned char *buf)
+{
+    struct memsource *mem = source->priv;
+    int yres = source->vi.yres;
+    int band = mem->tick * BAND_STEP % yres;
+    int end = band + BAND_ROWS < yres ? band + BAND_ROWS : yres;
+    int y;
+
+    if (mem->inplace && mem->band >= 0) {
+        int old_end = mem->band + BAND_ROWS < yres ? mem->band + BAND_ROWS
+                                                   : yres;
+
+        /* Put the background back where the band was, then draw it */
+        for (y = mem->band; y < old_end; y++) {
+            synthetic_row(source, buf, y, band);
+        }
+        mem_damage_rows(source, buf, mem->band, old_end);
+
+        for (y = band; y < end; y++) {
+            synthetic_row(source, buf, y, band);
+        }
+        mem_damage_rows(source, buf, band, end);
+    } else {
+        for (y = 0; y < yres; y++) {
+            synthetic_row(source, buf, y, band);
+        }
+        mem_damage_rows(source, buf, 0, yres);
+    }
+
+    mem->band = band;
+    mem->tick++;
+}
+
+static int synthetic_open(struct fbsource *source, const char *spec)
+{
+    struct memsource *mem = calloc(1, sizeof(*mem));
+    int width, height, bpp = 16;
+
+    mem->fps = DEFAULT_FPS;
+    spec = parse_mode(spec, &width, &height, &bpp, &mem->fps);
+    if (spec != NULL && !strcmp(spec, ",inplace")) {
+        mem->inplace = 1;
+    } else if (spec == NULL || *spec != '\0') {
+        printf("Usage: synthetic:WxH[xBPP][@FPS][,inplace]\n");
+        return -1;
+    }
+
+    mem->draw = synthetic_draw;
+    return mem_open(source, width, height, bpp, mem);
+}
+
+static void file_draw(struct fbsource *source, unsigned char *buf)
+{
+    struct memsource *mem = source->priv;
+    size_t size = source->vi.yres * source->fi.line_length;
+    off_t offset = (off_t)(mem->tick++ % mem->nframes) * size;
+
+    if (pread(mem->fd, buf, size, offset) != (ssize_t)size) {
+        printf("Short read from recording, %s\n", strerror(errno));
+    }
+    mem_damage_rows(source, buf, 0, source->vi.yres);
+}
+
+static int file_open(struct fbsource *source, const char *spec)
+{
+    struct memsource *mem = calloc(1, sizeof(*mem));
+    int width, height;
+    struct stat st;
+
+    mem->fps = DEFAULT_FPS;
+    spec = parse_mode(spec, &width, &height, NULL, &mem->fps);
+    if (spec == NULL || *spec != ':' || width <= 0 || height <= 0) {
+        printf("Usage: file:WxH[@FPS]:path\n");
+        return -1;
+    }
+    spec++;
+
+    if (0 > (mem->fd = open(spec, O_RDONLY)) || 0 > fstat(mem->fd, &st)) {
+        printf("Failed to open %s, %s\n", spec, strerror(errno));
+        return -1;
+    }
+
+    /* Raw frames as --headless writes them */
+    mem->nframes = st.st_size / ((off_t)width * height * 4);
+    if (mem->nframes == 0) {
+        printf("%s holds no whole %dx%d frame\n", spec, width, height);
+        return -1;
+    }
+    printf("Playing %lu frames from %s\n", mem->nframes, spec);
+
+    mem->draw = file_draw;
+    return mem_open(source, width, height, 32, mem);
+}
+
+int fbsource_open(struct fbsource *source, const char *spec)
+{
+    memset(source, 0, sizeof(*source));
+
+    if (!strncmp(spec, "synthetic:", 10)) {
+        return synthetic_open(source, spec + 10);
+    }
+    if (!strncmp(spec, "file:", 5)) {
+        return file_open(source, spec + 5);
+    }
+    return fbdev_open(source, spec);
+}
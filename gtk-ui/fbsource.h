@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Where captured frames come from. Besides the vfb device there are
+ * backends keeping the video memory in a memfd, drawn into by a thread of
+ * our own, so capture can be run and measured without the kernel side.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef FBSOURCE_H
+#define FBSOURCE_H
+
+#include <stddef.h>
+#include <linux/fb.h>
+#include <linux/vfb.h>
+
+struct fbsource {
+    unsigned char *bits;            /* video memory, fi.smem_len bytes */
+    struct fb_var_screeninfo vi;
+    struct fb_fix_screeninfo fi;
+    struct vfb_status *status;      /* front buffer position, NULL if the
+                                       source can't tell */
+
+    /* Block until a new frame may be up, or until timeout_ms has passed.
+       *seq is the last frame seen and gets updated. Returns 1 if a new
+       frame may be up. */
+    int (*wait_frame)(struct fbsource *source, unsigned int *seq,
+                      int timeout_ms);
+
+    /* Fill the page bitmap map with the pages written since the last
+       call. Returns the number of them, or -1 if unknown and everything
+       has to be refreshed. */
+    int (*fetch_damage)(struct fbsource *source, unsigned char *map,
+                        size_t len);
+
+    /* Current mode, for the pan offsets when there is no status page */
+    int (*get_var)(struct fbsource *source, struct fb_var_screeninfo *var);
+
+    void *priv;
+};
+
+/*
+ * spec is one of
+ *   /dev/fbN                           a framebuffer device
+ *   synthetic:WxH[xBPP][@FPS][,inplace] a test pattern, flipped between
+ *                                      two buffers or drawn in place
+ *   file:WxH[@FPS]:path                raw XRGB8888 frames as written by
+ *                                      --headless, played in a loop
+ */
+int fbsource_open(struct fbsource *source, const char *spec);
+
+#endif /* FBSOURCE_H */
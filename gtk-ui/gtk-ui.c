@@ -22,7 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
+#include <sys/eventfd.h>
 
 #include <unistd.h>
 #include <pthread.h>
@@ -35,29 +35,47 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
+#include <math.h>
 
 #include <gtk/gtk.h>
 
-#define IMAGE_WIDTH  640
-#define IMAGE_HEIGHT 480
+#include "capture.h"
+#include "convert.h"
+#include "headless.h"
+#include "hist.h"
+#include "stats.h"
+#include "inject.h"
+
 
 #define EV_PRESSED  1
 #define EV_RELEASED 0
 
-static GdkPixmap *pixmap = NULL;
-guchar rgbbuf[IMAGE_WIDTH * IMAGE_HEIGHT * 3];
-static int currently_drawing = 0;
+/* Paint straight from the mmapped front buffer instead of going through
+   the frame slots */
+static int direct = 0;
+static cairo_format_t direct_format;
 
-/* Framebuffer */
-guchar*                  bits;
-int                      bpp;    /* byte per pixel */
-int                      stride; /* size of stride in pixel */
-struct fb_var_screeninfo vi;
-struct fb_fix_screeninfo fi;
+/* The frame slots wrapped for painting, unused in direct mode */
+static cairo_surface_t *surfaces[3];
 
 /* Input events */
 static char INPUT_DEVICE[PATH_MAX] = "/dev/input/event2"; /* TODO: This is hardcoded for now... */
 static int inputfd = -1;
+/* androidinput's bulk injection device, used instead of evdev if there */
+#define BULK_INPUT_DEVICE "/dev/android_input"
+static int bulkfd = -1;
+/*
+ * --latency: time from injecting a touch to the first frame that changes
+ * after it (input to fb), and from there to that frame being painted
+ * (fb to screen). One probe is in flight at a time, so measure against a
+ * screen that only changes in response to input.
+ */
+static int latency_mode = 0;
+static struct hist input_to_fb, fb_to_screen;
+static int max_contacts; /* multitouch slots, 0 for single touch */
+/* At most one touch move per this many ms, one frame at 60 Hz */
+static int motion_interval = 16;
+
 static int xmin, xmax;
 static int ymin, ymax;
 
@@ -66,87 +84,120 @@ static gboolean configure_event(GtkWidget *widget, GdkEventConfigure *event)
     return TRUE;
 }
 
-void *do_draw(void *ptr)
+/* Main loop side of the triple buffer: take the newest frame and queue a
+   redraw of what changed */
+static gboolean frame_ready(GIOChannel *source, GIOCondition condition,
+                            gpointer data)
 {
-    siginfo_t info;
-    sigset_t sigset;
+    GtkWidget *widget = data;
+    struct frame *f;
+    eventfd_t count;
+    uint64_t start = hist_now();
+    int i;
 
-    sigemptyset(&sigset);
-    sigaddset(&sigset, SIGALRM);
+    eventfd_read(frame_eventfd, &count);
 
-    while (1) {
-        while (sigwaitinfo(&sigset, &info) > 0) {
-            currently_drawing = 1;
+    if ((f = capture_acquire()) == NULL) {
+        return TRUE;
+    }
 
-            int width, height;
-            gdk_threads_enter();
-            gdk_drawable_get_size(pixmap, &width, &height);
-            gdk_threads_leave();
-            
-            memcpy(rgbbuf, 
-                   bits + (vi.xoffset + vi.yoffset*vi.xres_virtual)*bpp, 
-                   vi.yres*stride*bpp);
+    if (surfaces[frame_slots.front] != NULL) {
+        cairo_surface_mark_dirty(surfaces[frame_slots.front]);
+    }
 
-            cairo_surface_t *cst = 
-                cairo_image_surface_create_for_data(rgbbuf,
-                  CAIRO_FORMAT_RGB16_565, IMAGE_WIDTH, IMAGE_HEIGHT, 
-                  stride*bpp);
+    for (i = 0; i < f->nbands; i++) {
+        gtk_widget_queue_draw_area(widget, 0, f->bands[i].y1, vi.xres,
+                                   f->bands[i].y2 - f->bands[i].y1);
+    }
 
-            /* When dealing with gdkPixmap's, we need to make sure not to
-               access them from outside gtk_main(). */
-            gdk_threads_enter();
+    stats_add(STAGE_QUEUE, hist_now() - start);
+    return TRUE;
+}
 
-            cairo_t *cr_pixmap = gdk_cairo_create(pixmap);
-            cairo_set_source_surface(cr_pixmap, cst, 0, 0);
-            cairo_paint(cr_pixmap);
-            cairo_destroy(cr_pixmap);
+/* Direct mode: wrap the front buffer in a cairo surface and blit it to the
+   window, without any intermediate copy */
+static void expose_direct(GtkWidget *widget, GdkEventExpose *event)
+{
+    unsigned long front;
+    unsigned int seq;
 
-            gdk_threads_leave();
+    seq = front_begin(&front);
 
-            cairo_surface_destroy(cst);
+    cairo_surface_t *cst =
+        cairo_image_surface_create_for_data(bits + front,
+          direct_format, vi.xres, vi.yres, fi.line_length);
 
-            currently_drawing = 0;
-        }
+    cairo_t *cr = gdk_cairo_create(widget->window);
+    gdk_cairo_rectangle(cr, &event->area);
+    cairo_clip(cr);
+    cairo_set_source_surface(cr, cst, 0, 0);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+
+    cairo_surface_destroy(cst);
+
+    /* Flipped while we were reading, paint it again */
+    if (front_retry(seq)) {
+        gtk_widget_queue_draw_area(widget, event->area.x, event->area.y,
+                                   event->area.width, event->area.height);
     }
 }
 
-gboolean timer_exe(GtkWidget *widget)
+/* Latency probe: the frame a probe rode on has been painted */
+static void probe_painted(struct frame *f)
 {
-    static int first_time = 1;
-    static pthread_t thread_info;
-    int width, height;
-
-    int drawing_status = g_atomic_int_get(&currently_drawing);
+    /* The capture thread may be moving it on to the next frame, if it
+       thinks we haven't taken this one */
+    uint64_t input = __atomic_exchange_n(&f->probe_input, 0,
+                                         __ATOMIC_RELAXED);
 
-    if (first_time == 1) {
-        int  iret;
-        iret = pthread_create(&thread_info, NULL, do_draw, NULL);
+    if (!input) {
+        return;
     }
 
-    if (drawing_status == 0) {
-        pthread_kill(thread_info, SIGALRM);
-    }
+    /* Painted means the X server has it */
+    gdk_flush();
+    hist_add(&input_to_fb, f->probe_fb - input);
+    hist_add(&fb_to_screen, hist_now() - f->probe_fb);
+}
 
-    gdk_drawable_get_size(pixmap, &width, &height);
-    gtk_widget_queue_draw_area(widget, 0, 0, width, height);
+static gboolean latency_report(gpointer data)
+{
+    static uint64_t reported;
 
-    first_time = 0;
+    if (input_to_fb.count != reported) {
+        hist_print("input->fb", &input_to_fb);
+        hist_print("fb->screen", &fb_to_screen);
+        reported = input_to_fb.count;
+    }
     return TRUE;
 }
 
 static gboolean expose_event(GtkWidget *widget, GdkEventExpose *event)
 {
-    cairo_t *cr = gdk_cairo_create(widget->window);
-    gdk_cairo_set_source_pixmap(cr, pixmap, 0, 0);
-    cairo_paint(cr);
-    cairo_destroy(cr);
+    uint64_t start = hist_now();
 
+    if (direct) {
+        expose_direct(widget, event);
+    } else {
+        cairo_t *cr = gdk_cairo_create(widget->window);
+        gdk_cairo_rectangle(cr, &event->area);
+        cairo_clip(cr);
+        cairo_set_source_surface(cr, surfaces[frame_slots.front], 0, 0);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+    }
+
+    stats_add(STAGE_EXPOSE, hist_now() - start);
+
+    probe_painted(&frames[frame_slots.front]);
     return FALSE;
 }
 
 static void init_input_device()
 {
     struct input_absinfo info;
+    unsigned char absbits[ABS_MAX / 8 + 1];
     
     if ((inputfd = open(INPUT_DEVICE, O_RDWR)) == -1) {
         printf("Cannot open input device %s\n", INPUT_DEVICE);
@@ -177,10 +228,48 @@ static void init_input_device()
     } else {
         printf("Touch device has no ymax: using emulator mode\n");
     }
+
+    /* Multitouch protocol B if the device has slots */
+    memset(absbits, 0, sizeof(absbits));
+    ioctl(inputfd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits);
+    if (absbits[ABS_MT_SLOT / 8] & (1 << (ABS_MT_SLOT % 8)) &&
+        !ioctl(inputfd, EVIOCGABS(ABS_MT_SLOT), &info)) {
+        max_contacts = info.maximum + 1;
+        printf("Touch device has %d contacts\n", max_contacts);
+    } else {
+        printf("Touch device is single touch, no pinch or rotate\n");
+    }
+
+    if (0 <= (bulkfd = open(BULK_INPUT_DEVICE, O_WRONLY))) {
+        printf("Injecting through %s\n", BULK_INPUT_DEVICE);
+    }
+
+    /* Latency probes start from touches that reach the device, hover
+       while the button is up writes nothing */
+    if (latency_mode) {
+        inject_set_touch_callback(capture_probe);
+    }
+
+    /* Events are written by their own thread, see inject.c */
+    if (inject_init(bulkfd >= 0 ? bulkfd : inputfd, bulkfd >= 0,
+                    motion_interval, max_contacts) < 0) {
+        exit(EXIT_FAILURE);
+    }
 }
 
 static void cleanup_input()
 {
+    struct inject_stats stats;
+
+    inject_get_stats(&stats);
+    printf("Input: %lu events in %lu writes, %lu dropped, %lu coalesced, "
+           "queue depth max %u, latency avg %.0f us max %.0f us\n",
+           stats.events, stats.batches, stats.dropped, stats.coalesced,
+           stats.max_depth, stats.latency_avg_us, stats.latency_max_us);
+
+    if (bulkfd != -1) {
+        close(bulkfd);
+    }
     if (inputfd != -1) {
         close(inputfd);
     }
@@ -188,72 +277,91 @@ static void cleanup_input()
 
 void injectKeyEvent(unsigned int code, unsigned int value)
 {
-    struct input_event ev;
-    
-    memset(&ev, 0, sizeof(ev));
-    gettimeofday(&ev.time, 0);
-    ev.type = EV_KEY;
-    ev.code = code;
-    ev.value = value;
-    if (write(inputfd, &ev, sizeof(ev)) < 0) {
-        printf("Event failed, %s\n", strerror(errno));
-    }
-
-    /*gettimeofday(&ev.time,0);
-    ev.type = EV_SYN;
-    ev.code = 0;
-    ev.value = 0;
-    if(write(inputfd, &ev, sizeof(ev)) < 0) {
-        printf("Event failed, %s\n", strerror(errno));
-    }*/
+    inject_key(code, value);
+}
+
+/* Re-calculate the final x and y if xmax/ymax are specified */
+static void scale_touch(int *x, int *y)
+{
+    if (xmax) *x = xmin + (*x * (xmax - xmin)) / (vi.xres);
+    if (ymax) *y = ymin + (*y * (ymax - ymin)) / (vi.yres);
 }
 
 void injectTouchEvent(int down, int x, int y)
 {
-    struct input_event ev;
+    scale_touch(&x, &y);
+    inject_touch(down, x, y);
+}
 
-    /* Re-calculate the final x and y if xmax/ymax are specified */
-    if (xmax) x = xmin + (x * (xmax - xmin)) / (vi.xres);
-    if (ymax) y = ymin + (y * (ymax - ymin)) / (vi.yres);
-    
-    memset(&ev, 0, sizeof(ev));
+void injectMotionEvent(int x, int y)
+{
+    scale_touch(&x, &y);
+    inject_motion(x, y);
+}
 
-    gettimeofday(&ev.time,0);
-    ev.type = EV_KEY;
-    ev.code = BTN_TOUCH;
-    ev.value = down;
-    if (write(inputfd, &ev, sizeof(ev)) < 0) {
-        printf("Write event failed, %s\n", strerror(errno));
-    }
+/*
+ * Two finger gestures from a mouse: holding Ctrl when pressing pinches,
+ * Ctrl+Shift rotates. The fingers sit on opposite sides of the centre of
+ * the display, one under the pointer. A pinch keeps the angle they had at
+ * the press and follows the pointer's distance from the centre, a rotation
+ * keeps the distance and follows the angle.
+ */
+enum gesture {
+    GESTURE_NONE,
+    GESTURE_PINCH,
+    GESTURE_ROTATE,
+};
 
-    gettimeofday(&ev.time,0);
-    ev.type = EV_ABS;
-    ev.code = ABS_X;
-    ev.value = x;
-    if (write(inputfd, &ev, sizeof(ev)) < 0) {
-        printf("Write event failed, %s\n", strerror(errno));
-    }
+static enum gesture gesture = GESTURE_NONE;
+static double gesture_radius, gesture_angle; /* at the press */
 
-    gettimeofday(&ev.time,0);
-    ev.type = EV_ABS;
-    ev.code = ABS_Y;
-    ev.value = y;
-    if (write(inputfd, &ev, sizeof(ev)) < 0) {
-        printf("Write event failed, %s\n", strerror(errno));
-    }
+static int clamp(int value, int max)
+{
+    return value < 0 ? 0 : value > max ? max : value;
+}
 
-    gettimeofday(&ev.time,0);
-    ev.type = EV_SYN;
-    ev.code = 0;
-    ev.value = 0;
-    if (write(inputfd, &ev, sizeof(ev)) < 0) {
-        printf("Write event failed, %s\n", strerror(errno));
+static void injectGestureEvent(int down, int motion, double x, double y)
+{
+    struct inject_contact contacts[2];
+    double cx = vi.xres / 2.0, cy = vi.yres / 2.0;
+    double radius = hypot(x - cx, y - cy), angle = atan2(y - cy, x - cx);
+    double dx, dy;
+    int i;
+
+    if (gesture == GESTURE_PINCH) {
+        angle = gesture_angle;
+    } else {
+        radius = gesture_radius;
+    }
+    dx = radius * cos(angle);
+    dy = radius * sin(angle);
+
+    for (i = 0; i < 2; i++) {
+        contacts[i].slot = i;
+        contacts[i].down = down;
+        contacts[i].x = clamp(cx + (i ? -dx : dx), vi.xres - 1);
+        contacts[i].y = clamp(cy + (i ? -dy : dy), vi.yres - 1);
+        scale_touch(&contacts[i].x, &contacts[i].y);
     }
+
+    inject_frame(contacts, 2, motion);
 }
 
 static gboolean button_press_event(GtkWidget *widget, GdkEventButton *event)
 {
-    if (event->button == 1) {
+    if (event->button != 1) {
+        return TRUE;
+    }
+
+    if (event->state & GDK_CONTROL_MASK && max_contacts >= 2) {
+        double dx = event->x - vi.xres / 2.0, dy = event->y - vi.yres / 2.0;
+
+        gesture = event->state & GDK_SHIFT_MASK ? GESTURE_ROTATE
+                                                : GESTURE_PINCH;
+        gesture_radius = hypot(dx, dy);
+        gesture_angle = atan2(dy, dx);
+        injectGestureEvent(1, 0, event->x, event->y);
+    } else {
         injectTouchEvent(1, event->x, event->y);
     }
 
@@ -262,7 +370,14 @@ static gboolean button_press_event(GtkWidget *widget, GdkEventButton *event)
 
 static gboolean button_release_event(GtkWidget *widget, GdkEventButton *event, gpointer user_data)
 {
-    if (event->button == 1) {
+    if (event->button != 1) {
+        return TRUE;
+    }
+
+    if (gesture != GESTURE_NONE) {
+        injectGestureEvent(0, 0, event->x, event->y);
+        gesture = GESTURE_NONE;
+    } else {
         injectTouchEvent(0, event->x, event->y);
     }
 
@@ -271,21 +386,20 @@ static gboolean button_release_event(GtkWidget *widget, GdkEventButton *event, g
 
 static gboolean motion_notify_event(GtkWidget *widget, GdkEventMotion *event, gpointer user_data)
 {
-    int x, y;
-    GdkModifierType state;
-
-    if (event->is_hint) {
-        gdk_window_get_pointer(event->window, &x, &y, &state);
-    } else {
-        x = event->x;
-        y = event->y;
-        state = event->state;
-    }
-
-    if (state & GDK_BUTTON1_MASK) {
-        injectTouchEvent(1, x, y);
+    /* The position comes with the event, no need to ask the X server.
+       The injector coalesces, see --motion-interval. */
+    if (!(event->state & GDK_BUTTON1_MASK)) {
+        /* Missed the release somehow */
+        if (gesture != GESTURE_NONE) {
+            injectGestureEvent(0, 0, event->x, event->y);
+            gesture = GESTURE_NONE;
+        } else {
+            injectTouchEvent(0, event->x, event->y);
+        }
+    } else if (gesture != GESTURE_NONE) {
+        injectGestureEvent(1, 1, event->x, event->y);
     } else {
-        injectTouchEvent(0, x, y);
+        injectMotionEvent(event->x, event->y);
     }
 
     return TRUE;
@@ -293,6 +407,11 @@ static gboolean motion_notify_event(GtkWidget *widget, GdkEventMotion *event, gp
 
 static void destroy(GtkWidget *widget, gpointer data)
 {
+    stats_dump();
+    if (latency_mode) {
+        hist_print("input->fb", &input_to_fb);
+        hist_print("fb->screen", &fb_to_screen);
+    }
     cleanup_input();
     gtk_main_quit();
 }
@@ -320,61 +439,99 @@ static void menu_button_clicked()
 
 int main(int argc, char *argv[])
 {
-    int fd;
-
     GtkWidget *window;
     GtkWidget *drawing_area;
     GtkWidget *vbox;
     GtkWidget *hbox;
     GtkWidget *button;
-    
-    /* Block SIGALRM in the main thread */
-    sigset_t sigset;
-    sigemptyset(&sigset);
-    sigaddset(&sigset, SIGALRM);
-    pthread_sigmask(SIG_BLOCK, &sigset, NULL);
-    
-    if (!g_thread_supported()) {
-        g_thread_init(NULL);
+    struct headless_options headless = { "-", HEADLESS_RAW, 0, 0, 0 };
+    const char *source = "/dev/fb0";
+    int headless_mode = 0;
+    int stats_interval = 0;
+    int i;
+
+    /* Headless runs without a display, so GTK mustn't see it */
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--headless")) {
+            headless_mode = 1;
+        }
     }
 
-    gdk_threads_init();
-    gdk_threads_enter();
-    
-    gtk_init(&argc, &argv);
+    /* Before GLib starts any threads, see stats.h */
+    stats_init();
 
-    /* Framebuffer */
-    
-    /* Open framebuffer */
-    if (0 > (fd = open("/dev/fb0", O_RDWR))) {
-        printf("Failed to open fb\n");
-        return -1;
+    if (!headless_mode) {
+        if (!g_thread_supported()) {
+            g_thread_init(NULL);
+        }
+
+        gtk_init(&argc, &argv);
     }
 
-    /* Get fixed information */
-    if(0 > ioctl(fd, FBIOGET_FSCREENINFO, &fi)) {
-        printf("Failed to get fixed info\n");
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--headless")) {
+            continue;
+        } else if (!strcmp(argv[i], "--source") && i + 1 < argc) {
+            source = argv[++i];
+        } else if (!strcmp(argv[i], "--output") && i + 1 < argc) {
+            headless.output = argv[++i];
+        } else if (!strcmp(argv[i], "--format") && i + 1 < argc &&
+                   (!strcmp(argv[i + 1], "raw") ||
+                    !strcmp(argv[i + 1], "y4m"))) {
+            headless.format = !strcmp(argv[++i], "y4m") ? HEADLESS_Y4M
+                                                        : HEADLESS_RAW;
+        } else if (!strcmp(argv[i], "--fps") && i + 1 < argc) {
+            headless.fps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--skip-unchanged")) {
+            headless.skip_unchanged = 1;
+        } else if (!strcmp(argv[i], "--block")) {
+            headless.block = 1;
+        } else if (!strcmp(argv[i], "--direct")) {
+            direct = 1;
+        } else if (!strcmp(argv[i], "--motion-interval") && i + 1 < argc) {
+            motion_interval = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--latency")) {
+            latency_mode = 1;
+        } else if (!strcmp(argv[i], "--stats") && i + 1 < argc) {
+            stats_interval = atoi(argv[++i]);
+        } else {
+            printf("Usage: %s [--source spec] [--direct] "
+                   "[--motion-interval ms] [--latency] [--stats seconds]\n"
+                   "       %s --headless [--source spec] "
+                   "[--output -|file|unix:path] "
+                   "[--format raw|y4m] [--fps n] [--skip-unchanged] "
+                   "[--block] [--stats seconds]\n", argv[0], argv[0]);
+            return -1;
+        }
+    }
+
+    if (headless_mode && headless_open(&headless) < 0) {
         return -1;
     }
 
-    /* Get variable information */
-    if(0 > ioctl(fd, FBIOGET_VSCREENINFO, &vi)) {
-        printf("Failed to get variable info\n");
+    if (stats_start(stats_interval) < 0) {
         return -1;
     }
 
-    /* Get raw bits buffer */
-    if(MAP_FAILED == (bits = mmap(0, fi.smem_len,
-                              PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))) {
-        printf("Failed to mmap fb\n");
+    if (capture_open(source) < 0) {
         return -1;
     }
 
-    printf("Framebuffer resolution: %d x %d\n", vi.xres, vi.yres);
+    if (headless_mode) {
+        i = headless_run(&headless);
+        stats_dump();
+        return i;
+    }
 
-    /* Calculate useful information */
-    bpp = vi.bits_per_pixel >> 3;
-    stride = fi.line_length / bpp;
+    /* Only formats cairo reads natively can be painted directly */
+    if (format == PIXEL_FORMAT_RGB565) {
+        direct_format = CAIRO_FORMAT_RGB16_565;
+    } else if (format == PIXEL_FORMAT_XRGB8888) {
+        direct_format = CAIRO_FORMAT_RGB24;
+    } else if (direct) {
+        printf("Direct mode needs RGB565 or XRGB8888, copying instead\n");
+        direct = 0;
+    }
 
     /* Do GTK stuff */
     window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -389,6 +546,11 @@ int main(int argc, char *argv[])
     gtk_widget_set_size_request(GTK_WIDGET(drawing_area), vi.xres, vi.yres);
     gtk_box_pack_start(GTK_BOX(vbox), drawing_area, TRUE, TRUE, 0);
     gtk_widget_show(drawing_area);
+
+    /* GTK's own double buffering would add another full copy */
+    if (direct) {
+        gtk_widget_set_double_buffered(drawing_area, FALSE);
+    }
     
     init_input_device();
 
@@ -397,8 +559,7 @@ int main(int argc, char *argv[])
                           | GDK_LEAVE_NOTIFY_MASK
                           | GDK_BUTTON_PRESS_MASK
                           | GDK_BUTTON_RELEASE_MASK
-                          | GDK_POINTER_MOTION_MASK
-                          | GDK_POINTER_MOTION_HINT_MASK);
+                          | GDK_POINTER_MOTION_MASK);
 
     g_signal_connect(drawing_area, "motion-notify-event",
                      G_CALLBACK (motion_notify_event), NULL);
@@ -436,13 +597,25 @@ int main(int argc, char *argv[])
 
     gtk_widget_show_all(window);
 
-    pixmap = gdk_pixmap_new(drawing_area->window, IMAGE_WIDTH, 
-                            IMAGE_HEIGHT, -1);
+    /* Capture each new frame and publish it to frame_ready */
+    if (capture_start(!direct, 0) < 0) {
+        return -1;
+    }
+    for (i = 0; i < 3 && !direct; i++) {
+        surfaces[i] = cairo_image_surface_create_for_data(
+            (guchar *)frames[i].pixels, CAIRO_FORMAT_RGB24,
+            vi.xres, vi.yres, vi.xres * 4);
+    }
+    g_io_add_watch(g_io_channel_unix_new(frame_eventfd), G_IO_IN,
+                   frame_ready, drawing_area);
 
-    (void)g_timeout_add(33, (GSourceFunc)timer_exe, drawing_area);
+    if (latency_mode) {
+        hist_init(&input_to_fb);
+        hist_init(&fb_to_screen);
+        g_timeout_add_seconds(5, latency_report, NULL);
+    }
 
     gtk_main();
-    gdk_threads_leave();
     
     return 0;
 }
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "capture.h"
+#include "convert.h"
+#include "headless.h"
+#include "hist.h"
+#include "stats.h"
+
+/* Y4M has to state a rate, this is what unpaced output claims */
+#define Y4M_DEFAULT_FPS 60
+
+#define Y4M_FRAME "FRAME\n"
+
+static int outfd = -1;
+
+/* Y4M: the frame header followed by the planes, written in one go */
+static uint8_t *y4m_frame;
+static size_t y4m_frame_len;
+
+static int open_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if (0 > (fd = socket(AF_UNIX, SOCK_STREAM, 0))) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int headless_open(const struct headless_options *options)
+{
+    const char *output = options->output;
+
+    if (!strcmp(output, "-")) {
+        /* Keep the frames on stdout and everything else off it */
+        fflush(stdout);
+        if (0 <= (outfd = dup(STDOUT_FILENO))) {
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+        }
+    } else if (!strncmp(output, "unix:", 5)) {
+        outfd = open_socket(output + 5);
+    } else {
+        outfd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    if (outfd < 0) {
+        printf("Failed to open %s, %s\n", output, strerror(errno));
+        return -1;
+    }
+
+    /* A reader going away shows up as EPIPE instead */
+    signal(SIGPIPE, SIG_IGN);
+    return 0;
+}
+
+static int write_all(const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t written;
+
+    while (len > 0) {
+        written = write(outfd, p, len);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            if (written == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+        p += written;
+        len -= written;
+    }
+    return 0;
+}
+
+static int write_header(const struct headless_options *options)
+{
+    int width = vi.xres, height = vi.yres;
+    int cw = (width + 1) / 2, ch = (height + 1) / 2;
+    char header[128];
+
+    if (options->format != HEADLESS_Y4M) {
+        return 0;
+    }
+
+    y4m_frame_len = strlen(Y4M_FRAME) + width * height + 2 * cw * ch;
+    y4m_frame = malloc(y4m_frame_len);
+    memcpy(y4m_frame, Y4M_FRAME, strlen(Y4M_FRAME));
+
+    snprintf(header, sizeof(header),
+             "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height,
+             options->fps ? options->fps : Y4M_DEFAULT_FPS);
+    return write_all(header, strlen(header));
+}
+
+static int write_frame(const struct frame *f,
+                       const struct headless_options *options)
+{
+    int width = vi.xres, height = vi.yres;
+    int cw = (width + 1) / 2, ch = (height + 1) / 2;
+    uint8_t *y;
+
+    if (options->format != HEADLESS_Y4M) {
+        return write_all(f->pixels, width * height * 4);
+    }
+
+    y = y4m_frame + strlen(Y4M_FRAME);
+    convert_xrgb_to_i420(y, y + width * height, y + width * height + cw * ch,
+                         f->pixels, width, height);
+    return write_all(y4m_frame, y4m_frame_len);
+}
+
+static void timespec_add_ns(struct timespec *ts, uint64_t ns)
+{
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+int headless_run(const struct headless_options *options)
+{
+    uint64_t period = options->fps ? 1000000000ULL / options->fps : 0;
+    unsigned long long written = 0, repeated = 0, skipped = 0;
+    size_t frame_size;
+    struct frame *f, *last = NULL;
+    struct timespec tick;
+    uint64_t begin, start;
+    double seconds;
+    int ret = 0;
+
+    if (capture_start(1, options->block) < 0) {
+        return -1;
+    }
+
+    if (write_header(options) < 0) {
+        printf("Failed to write header, %s\n", strerror(errno));
+        return -1;
+    }
+    frame_size = options->format == HEADLESS_Y4M ? y4m_frame_len
+                                                 : vi.xres * vi.yres * 4;
+
+    printf("Headless: %d x %d %s at %s to %s\n", vi.xres, vi.yres,
+           options->format == HEADLESS_Y4M ? "Y4M" : "raw XRGB8888",
+           options->fps ? "a fixed rate" : "capture rate", options->output);
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &tick);
+    begin = hist_now();
+
+    while (1) {
+        if (period) {
+            timespec_add_ns(&tick, period);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick,
+                                   NULL) == EINTR);
+        } else {
+            struct pollfd pfd = { frame_eventfd, POLLIN, 0 };
+            eventfd_t count;
+
+            if (poll(&pfd, 1, -1) < 0) {
+                continue;
+            }
+            eventfd_read(frame_eventfd, &count);
+        }
+
+        start = hist_now();
+
+        /* Capture only publishes frames that changed, so a tick without
+           one shows the same screen as the last */
+        if ((f = capture_acquire()) != NULL) {
+            last = f;
+        } else if (!period || last == NULL) {
+            continue;
+        } else if (options->skip_unchanged) {
+            skipped++;
+            continue;
+        } else {
+            repeated++;
+        }
+
+        if (write_frame(last, options) < 0) {
+            if (errno != EPIPE && errno != ECONNRESET) {
+                printf("Failed to write frame, %s\n", strerror(errno));
+                ret = -1;
+            }
+            break;
+        }
+        written++;
+        stats_add(STAGE_WRITE, hist_now() - start);
+
+        /* Fell more than a tick behind, don't try to catch up */
+        if (period && hist_now() > tick.tv_sec * 1000000000ULL
+                                   + tick.tv_nsec + period) {
+            clock_gettime(CLOCK_MONOTONIC, &tick);
+        }
+    }
+
+    seconds = (hist_now() - begin) / 1e9;
+    printf("Headless: %llu frames written, %llu repeated, %llu skipped in "
+           "%.1f s, %.1f fps, %.1f MB/s\n", written, repeated, skipped,
+           seconds, written / seconds, written * frame_size / 1e6 / seconds);
+
+    close(outfd);
+    return ret;
+}
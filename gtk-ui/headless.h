@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Headless output: the captured frames written to stdout, a file or a
+ * Unix socket instead of a window, for recording runs and measuring
+ * capture throughput without an X server.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+enum headless_format {
+    HEADLESS_RAW,   /* XRGB8888 frames back to back, no header */
+    HEADLESS_Y4M,   /* YUV4MPEG2, 4:2:0 */
+};
+
+struct headless_options {
+    const char *output;     /* "-" for stdout, "unix:path" for a socket */
+    enum headless_format format;
+    int fps;                /* write a frame every 1/fps s, 0 for every
+                               frame as it is captured */
+    int skip_unchanged;     /* when pacing, skip ticks with no new frame
+                               instead of repeating the last one */
+    int block;              /* make capture wait for us rather than drop */
+};
+
+/* Open the output. Call before anything is printed: with stdout as the
+   output, printf goes to stderr from here on. */
+int headless_open(const struct headless_options *options);
+
+/* Capture and write frames until the output goes away. Returns 0 then,
+   -1 on errors. */
+int headless_run(const struct headless_options *options);
+
+#endif /* HEADLESS_H */
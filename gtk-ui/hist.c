@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "hist.h"
+
+/* Values below 32 get a bucket each, above that every power of two is
+   split into 16 */
+static int bucket_of(uint64_t value)
+{
+    int e;
+
+    if (value < 32) {
+        return value;
+    }
+
+    e = 63 - __builtin_clzll(value);
+    return (e - 4) * 16 + ((value >> (e - 4)) & 15) + 16;
+}
+
+static uint64_t bucket_start(int bucket)
+{
+    int e, m;
+
+    if (bucket < 32) {
+        return bucket;
+    }
+
+    e = (bucket - 16) / 16 + 4;
+    m = (bucket - 16) % 16;
+    return (uint64_t)(16 + m) << (e - 4);
+}
+
+uint64_t hist_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void hist_init(struct hist *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+void hist_add(struct hist *hist, uint64_t value)
+{
+    /* Relaxed atomics cost next to nothing with a single writer and let
+       other threads read without tearing */
+    __atomic_fetch_add(&hist->buckets[bucket_of(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+    if (value > hist->max) {
+        __atomic_store_n(&hist->max, value, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELEASE);
+}
+
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+    int i;
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+uint64_t hist_percentile(const struct hist *hist, double p)
+{
+    uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_ACQUIRE);
+    uint64_t rank = p * count, seen = 0;
+    int i;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+        if (seen > rank) {
+            /* Middle of the bucket */
+            return (bucket_start(i) + bucket_start(i + 1)) / 2;
+        }
+    }
+    return hist->max;
+}
+
+void hist_print(const char *name, const struct hist *hist)
+{
+    uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_ACQUIRE);
+
+    printf("%-12s n=%-8llu avg %8.3f p50 %8.3f p95 %8.3f p99 %8.3f "
+           "max %8.3f ms\n", name, (unsigned long long)count,
+           count ? hist->sum / 1e6 / count : 0,
+           hist_percentile(hist, 0.50) / 1e6,
+           hist_percentile(hist, 0.95) / 1e6,
+           hist_percentile(hist, 0.99) / 1e6, hist->max / 1e6);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Log-linear latency histograms: 16 buckets per power of two, so any
+ * percentile is within about 6% of the true value. One thread adds to a
+ * histogram, any thread may read it.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+#define HIST_BUCKETS 992 /* enough for any 64 bit value */
+
+struct hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+/* Current CLOCK_MONOTONIC time in ns, what histograms are fed with */
+uint64_t hist_now(void);
+
+void hist_init(struct hist *hist);
+void hist_add(struct hist *hist, uint64_t value);
+
+/* Add src into dst, neither may be written meanwhile */
+void hist_merge(struct hist *dst, const struct hist *src);
+
+/* Value below which a fraction p (0 to 1) of the samples fall */
+uint64_t hist_percentile(const struct hist *hist, double p);
+
+/* One line: count, average, p50, p95, p99 and max, ns shown as ms */
+void hist_print(const char *name, const struct hist *hist);
+
+#endif /* HIST_H */
@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "input.h"
+#include "inject.h"
+#include "ring.h"
+
+#define QUEUE_SIZE 1024 /* events, a power of two */
+
+/* Room for the largest frame a single queued event turns into: slot,
+   tracking id and position per contact, then BTN_TOUCH, ABS_X, ABS_Y and
+   the SYN_REPORT */
+#define FRAME_MAX (4 * INJECT_MAX_CONTACTS + 4)
+
+enum {
+    INJECT_TOUCH,
+    INJECT_MOTION,
+    INJECT_KEY,
+};
+
+struct inject_event {
+    int type;
+    int ncontacts;          /* touch and motion */
+    struct inject_contact contacts[INJECT_MAX_CONTACTS];
+    int code, value;        /* key */
+    long long queued;       /* CLOCK_MONOTONIC ns */
+};
+
+static struct ring queue;
+static int inputfd = -1;
+static int inputbulk;
+static int wakefd = -1;
+static long long motion_interval; /* ns */
+static int max_slots;
+static void (*touch_callback)(uint64_t queued);
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct inject_stats stats;
+static double latency_total_us;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void queue_event(struct inject_event *ev)
+{
+    ev->queued = now_ns();
+
+    if (ring_push(&queue, ev) < 0) {
+        __atomic_add_fetch(&stats.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    /* The injector drains until the queue is empty, so it only needs
+       waking when this is the first event it will find */
+    if (ring_depth(&queue) == 1) {
+        eventfd_write(wakefd, 1);
+    }
+}
+
+void inject_frame(const struct inject_contact *contacts, int n, int motion)
+{
+    struct inject_event ev;
+
+    ev.type = motion ? INJECT_MOTION : INJECT_TOUCH;
+    ev.ncontacts = n < INJECT_MAX_CONTACTS ? n : INJECT_MAX_CONTACTS;
+    memcpy(ev.contacts, contacts, ev.ncontacts * sizeof(*contacts));
+    queue_event(&ev);
+}
+
+void inject_touch(int down, int x, int y)
+{
+    struct inject_contact contact = { 0, down, x, y };
+
+    inject_frame(&contact, 1, 0);
+}
+
+void inject_motion(int x, int y)
+{
+    struct inject_contact contact = { 0, 1, x, y };
+
+    inject_frame(&contact, 1, 1);
+}
+
+void inject_key(int code, int value)
+{
+    struct inject_event ev;
+
+    ev.type = INJECT_KEY;
+    ev.code = code;
+    ev.value = value;
+    queue_event(&ev);
+}
+
+void inject_set_touch_callback(void (*touch_sent)(uint64_t queued))
+{
+    touch_callback = touch_sent;
+}
+
+void inject_get_stats(struct inject_stats *out)
+{
+    pthread_mutex_lock(&stats_lock);
+    *out = stats;
+    out->dropped = __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+    out->coalesced = __atomic_load_n(&stats.coalesced, __ATOMIC_RELAXED);
+    out->latency_avg_us = stats.events ? latency_total_us / stats.events : 0;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Injector thread
+ */
+
+/* What the device was last told, -1 where unknown */
+struct slot_state {
+    int tracking_id;    /* -1 if no contact */
+    int x, y;
+};
+
+static struct slot_state slots[INJECT_MAX_CONTACTS];
+static int cur_slot = -1;
+static int next_tracking_id;
+static int sent_down = -1, sent_x = -1, sent_y = -1; /* single touch */
+
+static void forget_sent(void)
+{
+    int i;
+
+    for (i = 0; i < INJECT_MAX_CONTACTS; i++) {
+        slots[i].x = slots[i].y = -1;
+    }
+    cur_slot = -1;
+    sent_down = sent_x = sent_y = -1;
+}
+
+/* Protocol B events for one contact, only what changed */
+static void add_contact(struct input_packet *packet,
+                        const struct inject_contact *c)
+{
+    struct slot_state *s = &slots[c->slot];
+
+    if (!c->down && s->tracking_id < 0) {
+        return;
+    }
+    if (c->down && s->tracking_id >= 0 && c->x == s->x && c->y == s->y) {
+        return;
+    }
+
+    if (cur_slot != c->slot) {
+        input_packet_add(packet, EV_ABS, ABS_MT_SLOT, c->slot);
+        cur_slot = c->slot;
+    }
+
+    if (!c->down) {
+        input_packet_add(packet, EV_ABS, ABS_MT_TRACKING_ID, -1);
+        s->tracking_id = -1;
+        return;
+    }
+
+    if (s->tracking_id < 0) {
+        s->tracking_id = next_tracking_id;
+        next_tracking_id = (next_tracking_id + 1) & 0xffff;
+        input_packet_add(packet, EV_ABS, ABS_MT_TRACKING_ID, s->tracking_id);
+    }
+    if (c->x != s->x) {
+        input_packet_add(packet, EV_ABS, ABS_MT_POSITION_X, c->x);
+        s->x = c->x;
+    }
+    if (c->y != s->y) {
+        input_packet_add(packet, EV_ABS, ABS_MT_POSITION_Y, c->y);
+        s->y = c->y;
+    }
+}
+
+static void add_frame(struct input_packet *packet,
+                      const struct inject_contact *contacts, int n)
+{
+    int start = packet->count;
+    int down = 0, x = sent_x, y = sent_y, lowest = INJECT_MAX_CONTACTS;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (contacts[i].slot >= 0 && contacts[i].slot < max_slots) {
+            add_contact(packet, &contacts[i]);
+        }
+    }
+
+    /* Single touch follows the lowest slot that is down, which is all a
+       device without slots gets. The device's slots hold every contact
+       still down, not just those in this frame. */
+    for (i = 0; i < max_slots; i++) {
+        if (slots[i].tracking_id >= 0) {
+            down = 1;
+            x = slots[i].x;
+            y = slots[i].y;
+            break;
+        }
+    }
+    for (i = 0; i < n && !down; i++) {
+        if (contacts[i].down && contacts[i].slot >= max_slots &&
+            contacts[i].slot < lowest) {
+            lowest = contacts[i].slot;
+            x = contacts[i].x;
+            y = contacts[i].y;
+        }
+    }
+    if (lowest < INJECT_MAX_CONTACTS) {
+        down = 1;
+    }
+
+    /* Moving around without touching doesn't concern the device */
+    if (down || sent_down > 0) {
+        if (down != sent_down) {
+            input_packet_add(packet, EV_KEY, BTN_TOUCH, down);
+            sent_down = down;
+        }
+        if (x != sent_x) {
+            input_packet_add(packet, EV_ABS, ABS_X, x);
+            sent_x = x;
+        }
+        if (y != sent_y) {
+            input_packet_add(packet, EV_ABS, ABS_Y, y);
+            sent_y = y;
+        }
+    }
+
+    if (packet->count > start) {
+        input_packet_sync(packet);
+    }
+}
+
+/* When the first touch in the packet being built was queued, 0 if it
+   has none that changed anything */
+static long long touch_queued;
+
+static void flush(struct input_packet *packet, long long *queued, int n)
+{
+    double total = 0, max = 0;
+    long long now;
+    int i;
+
+    if (packet->count > 0) {
+        if ((inputbulk ? input_packet_send_bulk(inputfd, packet)
+                       : input_packet_send(inputfd, packet)) < 0) {
+            printf("Write event failed, %s\n", strerror(errno));
+            /* Don't know what got through, send everything next time */
+            forget_sent();
+        } else if (touch_queued && touch_callback) {
+            touch_callback(touch_queued);
+        }
+    }
+    touch_queued = 0;
+
+    now = now_ns();
+    for (i = 0; i < n; i++) {
+        double latency = (now - queued[i]) / 1e3;
+
+        total += latency;
+        if (latency > max) {
+            max = latency;
+        }
+    }
+
+    pthread_mutex_lock(&stats_lock);
+    stats.events += n;
+    stats.batches++;
+    latency_total_us += total;
+    if (max > stats.latency_max_us) {
+        stats.latency_max_us = max;
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/* Newest motion not sent yet, only the injector thread touches these */
+static int motion_pending;
+static struct inject_event motion;
+static long long motion_sent; /* when motion last went out */
+
+static void add_event(struct input_packet *packet, struct inject_event *ev)
+{
+    int start = packet->count;
+
+    switch (ev->type) {
+    case INJECT_TOUCH:
+    case INJECT_MOTION:
+        add_frame(packet, ev->contacts, ev->ncontacts);
+        if (ev->type == INJECT_MOTION) {
+            motion_sent = now_ns();
+        }
+        if (packet->count > start && !touch_queued) {
+            touch_queued = ev->queued;
+        }
+        break;
+    case INJECT_KEY:
+        input_packet_add(packet, EV_KEY, ev->code, ev->value);
+        input_packet_sync(packet);
+        break;
+    }
+}
+
+/* How long to sleep before pending motion is due, -1 for no limit */
+static int motion_timeout(void)
+{
+    long long wait;
+
+    if (!motion_pending) {
+        return -1;
+    }
+
+    wait = motion_sent + motion_interval - now_ns();
+    return wait > 0 ? (wait + 999999) / 1000000 : 0;
+}
+
+static void *inject_thread(void *ptr)
+{
+    long long queued[INPUT_PACKET_MAX];
+    struct input_packet packet;
+    struct inject_event ev;
+    struct pollfd pfd = { wakefd, POLLIN, 0 };
+    eventfd_t count;
+    unsigned int depth;
+    int timeout, n;
+
+    while (1) {
+        timeout = motion_timeout();
+        if (timeout != 0) {
+            if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+                printf("Injector wakeup failed, %s\n", strerror(errno));
+                return NULL;
+            }
+            if (pfd.revents & POLLIN) {
+                eventfd_read(wakefd, &count);
+            }
+        }
+
+        depth = ring_depth(&queue);
+        if (depth > stats.max_depth) {
+            pthread_mutex_lock(&stats_lock);
+            stats.max_depth = depth;
+            pthread_mutex_unlock(&stats_lock);
+        }
+
+        /* Everything queued so far goes out in as few writes as fit */
+        input_packet_init(&packet);
+        n = 0;
+        while (1) {
+            if (packet.count > INPUT_PACKET_MAX - 2 * FRAME_MAX ||
+                n >= INPUT_PACKET_MAX - 1) {
+                flush(&packet, queued, n);
+                n = 0;
+            }
+
+            if (ring_pop(&queue, &ev) < 0) {
+                break;
+            }
+
+            /* Only the newest motion matters, hold on to it until it is
+               due or something else has to go out after it */
+            if (ev.type == INJECT_MOTION) {
+                if (motion_pending) {
+                    __atomic_add_fetch(&stats.coalesced, 1,
+                                       __ATOMIC_RELAXED);
+                }
+                motion = ev;
+                motion_pending = 1;
+                continue;
+            }
+
+            if (motion_pending) {
+                add_event(&packet, &motion);
+                queued[n++] = motion.queued;
+                motion_pending = 0;
+            }
+            add_event(&packet, &ev);
+            queued[n++] = ev.queued;
+        }
+
+        if (motion_pending && motion_timeout() == 0) {
+            add_event(&packet, &motion);
+            queued[n++] = motion.queued;
+            motion_pending = 0;
+        }
+
+        if (n > 0) {
+            flush(&packet, queued, n);
+        }
+    }
+}
+
+int inject_init(int fd, int bulk, int motion_interval_ms,
+                int max_contacts)
+{
+    pthread_t thread;
+    int i;
+
+    inputfd = fd;
+    inputbulk = bulk;
+    motion_interval = motion_interval_ms * 1000000LL;
+    max_slots = max_contacts < INJECT_MAX_CONTACTS ? max_contacts
+                                                   : INJECT_MAX_CONTACTS;
+    for (i = 0; i < INJECT_MAX_CONTACTS; i++) {
+        slots[i].tracking_id = -1;
+    }
+    forget_sent();
+
+    if (ring_init(&queue, QUEUE_SIZE, sizeof(struct inject_event)) < 0) {
+        printf("Failed to allocate the input queue\n");
+        return -1;
+    }
+
+    if (0 > (wakefd = eventfd(0, 0))) {
+        printf("Failed to create input eventfd, %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (pthread_create(&thread, NULL, inject_thread, NULL)) {
+        printf("Failed to create input thread\n");
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Asynchronous input injection. GTK handlers queue events and return at
+ * once, a dedicated thread writes them to the input device in batches.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef INJECT_H
+#define INJECT_H
+
+#include <stdint.h>
+
+/* Most contacts in one frame, and the highest slot + 1 */
+#define INJECT_MAX_CONTACTS 10
+
+/* One finger. A contact stays down in its slot until a frame lifts it. */
+struct inject_contact {
+    int slot;
+    int down;
+    int x, y;
+};
+
+struct inject_stats {
+    unsigned long events;       /* queued and written */
+    unsigned long batches;      /* writes to the device */
+    unsigned long dropped;      /* queue was full */
+    unsigned long coalesced;    /* motion replaced by newer motion */
+    unsigned int max_depth;     /* most events waiting at once */
+    double latency_avg_us;      /* from queueing to written */
+    double latency_max_us;
+};
+
+/* Start the injector thread writing to fd, an evdev node or, with bulk
+   set, androidinput's bulk injection device. Motion is sent at most once
+   per motion_interval_ms, the newest position winning; 0 only merges
+   motion that queued up while the previous write was in progress.
+   max_contacts is the number of multitouch slots the device has, 0 for
+   a single touch device. Returns -1 on failure. */
+int inject_init(int fd, int bulk, int motion_interval_ms,
+                int max_contacts);
+
+/* Only ever call these from one thread, the GTK main loop */
+
+/* A whole multitouch frame, sent with a single SYN_REPORT. Contacts not
+   mentioned keep their state. motion says that only positions changed,
+   which lets the frame be coalesced with the next one. */
+void inject_frame(const struct inject_contact *contacts, int n, int motion);
+
+/* Single pointer in slot 0 */
+void inject_touch(int down, int x, int y);
+void inject_motion(int x, int y); /* with the touch down */
+
+void inject_key(int code, int value);
+
+/* Have touch_sent called from the injector thread whenever a touch or
+   motion that changed something has been written, with the
+   CLOCK_MONOTONIC ns it was queued at. Frames that repeat what the
+   device was last told write nothing and don't count. Set it before
+   inject_init(). */
+void inject_set_touch_callback(void (*touch_sent)(uint64_t queued));
+
+void inject_get_stats(struct inject_stats *stats);
+
+#endif /* INJECT_H */
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/androidinput.h>
+
+#include "input.h"
+
+void input_packet_init(struct input_packet *packet)
+{
+    packet->count = 0;
+}
+
+int input_packet_add(struct input_packet *packet, int type, int code,
+                     int value)
+{
+    struct input_event *ev;
+
+    /* Keep the last slot for the SYN_REPORT */
+    if (packet->count >= INPUT_PACKET_MAX - 1) {
+        return -1;
+    }
+
+    ev = &packet->events[packet->count++];
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
+    return 0;
+}
+
+int input_packet_sync(struct input_packet *packet)
+{
+    struct input_event *ev = &packet->events[packet->count];
+
+    if (packet->count >= INPUT_PACKET_MAX) {
+        return -1;
+    }
+
+    ev->type = EV_SYN;
+    ev->code = SYN_REPORT;
+    ev->value = 0;
+    packet->count++;
+    return 0;
+}
+
+static int input_packet_synced(struct input_packet *packet)
+{
+    struct input_event *ev = &packet->events[packet->count - 1];
+
+    return ev->type == EV_SYN && ev->code == SYN_REPORT;
+}
+
+int input_packet_send(int fd, struct input_packet *packet)
+{
+    struct timespec ts;
+    struct timeval time;
+    size_t len;
+    ssize_t written;
+    int i;
+
+    if (packet->count == 0) {
+        return 0;
+    }
+
+    /* input_packet_add() always leaves room for this */
+    if (!input_packet_synced(packet)) {
+        input_packet_sync(packet);
+    }
+
+    /* One monotonic timestamp for the whole packet, the way the kernel
+       stamps events from real hardware */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    time.tv_sec = ts.tv_sec;
+    time.tv_usec = ts.tv_nsec / 1000;
+    for (i = 0; i < packet->count; i++) {
+        packet->events[i].time = time;
+    }
+
+    /* evdev takes any number of whole events per write */
+    len = packet->count * sizeof(struct input_event);
+    do {
+        written = write(fd, packet->events, len);
+    } while (written < 0 && errno == EINTR);
+
+    packet->count = 0;
+
+    if (written < 0) {
+        return -1;
+    }
+    if ((size_t)written != len) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+int input_packet_send_bulk(int fd, struct input_packet *packet)
+{
+    struct android_input_event events[INPUT_PACKET_MAX];
+    size_t len, done;
+    ssize_t written;
+    int i;
+
+    if (packet->count == 0) {
+        return 0;
+    }
+
+    if (!input_packet_synced(packet)) {
+        input_packet_sync(packet);
+    }
+
+    for (i = 0; i < packet->count; i++) {
+        events[i].type = packet->events[i].type;
+        events[i].code = packet->events[i].code;
+        events[i].value = packet->events[i].value;
+    }
+
+    /* The driver may take fewer events than offered, whole frames only */
+    len = packet->count * sizeof(events[0]);
+    packet->count = 0;
+    for (done = 0; done < len; done += written) {
+        written = write(fd, (char *)events + done, len - done);
+        if (written < 0 && errno == EINTR) {
+            written = 0;
+        } else if (written <= 0) {
+            if (written == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Builds complete evdev event packets (everything up to and including the
+ * SYN_REPORT) and hands them to the kernel in one system call.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <linux/input.h>
+
+/* Room for one packet, the SYN_REPORT included */
+#define INPUT_PACKET_MAX 256
+
+struct input_packet {
+    struct input_event events[INPUT_PACKET_MAX];
+    int count;
+};
+
+void input_packet_init(struct input_packet *packet);
+
+/* Queue one event, returns -1 if the packet is full */
+int input_packet_add(struct input_packet *packet, int type, int code,
+                     int value);
+
+/* End one frame with SYN_REPORT, so several can go in one packet */
+int input_packet_sync(struct input_packet *packet);
+
+/* Terminate the packet with SYN_REPORT unless it already ends with one,
+   give every event the same timestamp and write it. Empty packets are not
+   sent. Returns -1 on error with errno set. */
+int input_packet_send(int fd, struct input_packet *packet);
+
+/* Same for androidinput's bulk injection device, /dev/android_input */
+int input_packet_send_bulk(int fd, struct input_packet *packet);
+
+#endif /* INPUT_H */
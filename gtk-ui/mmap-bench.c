@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Measures how long it takes to mmap the framebuffer and to touch every
+ * page of the mapping, for mapping sizes up to the whole video memory.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+
+#define ITERATIONS 20
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *device = argc > 1 ? argv[1] : "/dev/fb0";
+    long pagesize = sysconf(_SC_PAGESIZE);
+    struct fb_fix_screeninfo fi;
+    unsigned long size;
+    int fbfd, i;
+
+    if (0 > (fbfd = open(device, O_RDWR))) {
+        printf("Failed to open %s, %s\n", device, strerror(errno));
+        return -1;
+    }
+
+    if (0 > ioctl(fbfd, FBIOGET_FSCREENINFO, &fi)) {
+        printf("Failed to get fixed info\n");
+        return -1;
+    }
+
+    printf("%s: %uK of video memory\n", device, fi.smem_len >> 10);
+    printf("%10s %12s %12s %12s\n", "size", "mmap us", "touch us", "munmap us");
+
+    for (size = pagesize; ; size *= 2) {
+        double map = 0, touch = 0, unmap = 0;
+
+        if (size > fi.smem_len) {
+            size = fi.smem_len & ~(pagesize - 1);
+        }
+
+        for (i = 0; i < ITERATIONS; i++) {
+            volatile unsigned char *bits;
+            unsigned long offset;
+            double start;
+
+            start = now();
+            bits = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, 0);
+            if (bits == MAP_FAILED) {
+                printf("Failed to mmap %luK, %s\n", size >> 10,
+                       strerror(errno));
+                return -1;
+            }
+            map += now() - start;
+
+            /* Write to every page, like a producer drawing a full frame */
+            start = now();
+            for (offset = 0; offset < size; offset += pagesize) {
+                bits[offset] = bits[offset];
+            }
+            touch += now() - start;
+
+            start = now();
+            munmap((void *)bits, size);
+            unmap += now() - start;
+        }
+
+        printf("%9luK %12.1f %12.1f %12.1f\n", size >> 10,
+               map / ITERATIONS * 1e6, touch / ITERATIONS * 1e6,
+               unmap / ITERATIONS * 1e6);
+
+        if (size == (fi.smem_len & ~(pagesize - 1))) {
+            break;
+        }
+    }
+
+    close(fbfd);
+    return 0;
+}
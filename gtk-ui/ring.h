@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Lock-free ring buffer of fixed size elements for exactly one producer
+ * thread and one consumer thread.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdlib.h>
+#include <string.h>
+
+struct ring {
+    unsigned int head;  /* next slot to write, owned by the producer */
+    unsigned int tail;  /* next slot to read, owned by the consumer */
+    unsigned int mask;  /* number of slots - 1 */
+    size_t elem_size;
+    unsigned char *data;
+};
+
+/* nelem must be a power of two. Returns -1 if out of memory. */
+static inline int ring_init(struct ring *ring, unsigned int nelem,
+                            size_t elem_size)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = nelem - 1;
+    ring->elem_size = elem_size;
+    ring->data = malloc(nelem * elem_size);
+    return ring->data == NULL ? -1 : 0;
+}
+
+/* Number of elements waiting, exact only when called by either side */
+static inline unsigned int ring_depth(struct ring *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+           - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Producer: returns -1 if the ring is full */
+static inline int ring_push(struct ring *ring, const void *elem)
+{
+    unsigned int head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) {
+        return -1;
+    }
+
+    memcpy(ring->data + (head & ring->mask) * ring->elem_size, elem,
+           ring->elem_size);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Consumer: returns -1 if the ring is empty */
+static inline int ring_pop(struct ring *ring, void *elem)
+{
+    unsigned int tail = ring->tail;
+
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+
+    memcpy(elem, ring->data + (tail & ring->mask) * ring->elem_size,
+           ring->elem_size);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#endif /* RING_H */
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "stats.h"
+
+static const char *stage_names[STAGE_COUNT] = {
+    "wait", "damage", "convert", "publish", "queue", "expose", "write",
+};
+
+static struct hist stages[STAGE_COUNT];
+static uint64_t counters[COUNTER_COUNT];
+static int interval;
+static sigset_t signals;   /* SIGUSR1, only the stats thread takes it */
+
+void stats_add(enum stage stage, uint64_t ns)
+{
+    hist_add(&stages[stage], ns);
+}
+
+void stats_count(enum counter counter)
+{
+    __atomic_fetch_add(&counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+static uint64_t counter(enum counter counter)
+{
+    return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+void stats_dump(void)
+{
+    int i;
+
+    printf("Frames: %llu published, %llu dropped, %llu presented\n",
+           (unsigned long long)counter(COUNTER_FRAMES),
+           (unsigned long long)counter(COUNTER_DROPPED),
+           (unsigned long long)counter(COUNTER_PRESENTED));
+    for (i = 0; i < STAGE_COUNT; i++) {
+        hist_print(stage_names[i], &stages[i]);
+    }
+    fflush(stdout);
+}
+
+/* One line covering the last interval: rates and average stage costs */
+static void stats_line(void)
+{
+    static uint64_t last_counters[COUNTER_COUNT];
+    static uint64_t last_count[STAGE_COUNT], last_sum[STAGE_COUNT];
+    uint64_t now[COUNTER_COUNT];
+    int i;
+
+    for (i = 0; i < COUNTER_COUNT; i++) {
+        now[i] = counter(i);
+    }
+
+    printf("stats: %.1f fps, %.1f presented/s, %llu dropped",
+           (double)(now[COUNTER_FRAMES] - last_counters[COUNTER_FRAMES])
+           / interval,
+           (double)(now[COUNTER_PRESENTED] - last_counters[COUNTER_PRESENTED])
+           / interval,
+           (unsigned long long)(now[COUNTER_DROPPED]
+                                - last_counters[COUNTER_DROPPED]));
+
+    for (i = 0; i < STAGE_COUNT; i++) {
+        uint64_t count = __atomic_load_n(&stages[i].count, __ATOMIC_ACQUIRE);
+        uint64_t sum = __atomic_load_n(&stages[i].sum, __ATOMIC_RELAXED);
+
+        printf(", %s %.3f", stage_names[i], count == last_count[i] ? 0 :
+               (sum - last_sum[i]) / 1e6 / (count - last_count[i]));
+        last_count[i] = count;
+        last_sum[i] = sum;
+    }
+    printf(" ms\n");
+    fflush(stdout);
+
+    for (i = 0; i < COUNTER_COUNT; i++) {
+        last_counters[i] = now[i];
+    }
+}
+
+static void *stats_thread(void *ptr)
+{
+    sigset_t *set = ptr;
+    struct timespec timeout = { interval, 0 };
+
+    while (1) {
+        int sig = interval ? sigtimedwait(set, NULL, &timeout)
+                           : sigwaitinfo(set, NULL);
+
+        if (sig == SIGUSR1) {
+            stats_dump();
+        } else if (sig < 0 && errno == EAGAIN) {
+            stats_line();
+        } else if (sig < 0 && errno != EINTR) {
+            break;
+        }
+    }
+
+    printf("Stats thread failed, %s\n", strerror(errno));
+    return NULL;
+}
+
+void stats_init(void)
+{
+    int i;
+
+    for (i = 0; i < STAGE_COUNT; i++) {
+        hist_init(&stages[i]);
+    }
+
+    /* Inherited by every thread created from now on */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}
+
+int stats_start(int seconds)
+{
+    pthread_t thread;
+
+    interval = seconds;
+    if (pthread_create(&thread, NULL, stats_thread, &signals)) {
+        printf("Failed to create stats thread\n");
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Always-on frame pipeline instrumentation. Each stage has its own
+ * histogram written by the one thread that runs the stage, so recording
+ * takes no locks. Dumped on SIGUSR1 and at exit, optionally summarized
+ * every few seconds.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+#include "hist.h"
+
+enum stage {
+    STAGE_WAIT,         /* capture: waiting for a new frame */
+    STAGE_DAMAGE,       /* capture: fetching the damage */
+    STAGE_CONVERT,      /* capture: copying and converting */
+    STAGE_PUBLISH,      /* capture: handing the frame to the main loop */
+    STAGE_QUEUE,        /* main loop: taking the frame, queueing draws */
+    STAGE_EXPOSE,       /* main loop: painting */
+    STAGE_WRITE,        /* headless: encoding and writing out */
+    STAGE_COUNT
+};
+
+enum counter {
+    COUNTER_FRAMES,     /* published by the capture thread */
+    COUNTER_DROPPED,    /* replaced before the main loop took them */
+    COUNTER_PRESENTED,  /* taken by the main loop or headless writer */
+    COUNTER_COUNT
+};
+
+/* Call before starting any other thread, libraries' included, so that
+   SIGUSR1 is blocked in all of them */
+void stats_init(void);
+
+/* Start the thread that handles SIGUSR1. interval is the number of
+   seconds between summary lines, 0 for none. */
+int stats_start(int interval);
+
+void stats_add(enum stage stage, uint64_t ns);
+void stats_count(enum counter counter);
+
+/* Everything so far, per stage percentiles and the counters */
+void stats_dump(void);
+
+#endif /* STATS_H */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2011 Philip Åkesson <philip.akesson@gmail.com>
+ *
+ * Lock-free triple buffer for handing frames from one producer thread to
+ * one consumer thread. The producer always has a slot to write into, the
+ * consumer always has a complete frame to read from, and the third slot
+ * holds the newest published frame until one of them swaps it out.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef TRIPLEBUF_H
+#define TRIPLEBUF_H
+
+/* Set in middle while it holds a frame the consumer hasn't taken yet */
+#define TRIPLEBUF_FRESH 4
+
+struct triplebuf {
+    int back;   /* slot index owned by the producer */
+    int middle; /* shared, slot index | TRIPLEBUF_FRESH */
+    int front;  /* slot index owned by the consumer */
+};
+
+static inline void triplebuf_init(struct triplebuf *tb)
+{
+    tb->back = 0;
+    tb->middle = 1;
+    tb->front = 2;
+}
+
+/* Producer: non-zero if the last published frame hasn't been taken yet,
+   so anything it carried still has to reach the consumer */
+static inline int triplebuf_pending(struct triplebuf *tb)
+{
+    return __atomic_load_n(&tb->middle, __ATOMIC_ACQUIRE) & TRIPLEBUF_FRESH;
+}
+
+/* Producer: slot of the last published frame if it hasn't been taken yet,
+   -1 otherwise. The consumer may take it meanwhile but never writes it. */
+static inline int triplebuf_unread(struct triplebuf *tb)
+{
+    int middle = __atomic_load_n(&tb->middle, __ATOMIC_ACQUIRE);
+
+    return middle & TRIPLEBUF_FRESH ? middle & ~TRIPLEBUF_FRESH : -1;
+}
+
+/* Producer: publish the back slot and get a new one to write into. Returns
+   non-zero if the frame it replaced was never taken. */
+static inline int triplebuf_publish(struct triplebuf *tb)
+{
+    int old = __atomic_exchange_n(&tb->middle, tb->back | TRIPLEBUF_FRESH,
+                                  __ATOMIC_ACQ_REL);
+
+    tb->back = old & ~TRIPLEBUF_FRESH;
+    return old & TRIPLEBUF_FRESH;
+}
+
+/* Consumer: swap in the newest published frame. Returns non-zero if front
+   changed. */
+static inline int triplebuf_acquire(struct triplebuf *tb)
+{
+    int old;
+
+    if (!triplebuf_pending(tb)) {
+        return 0;
+    }
+
+    old = __atomic_exchange_n(&tb->middle, tb->front, __ATOMIC_ACQ_REL);
+    tb->front = old & ~TRIPLEBUF_FRESH;
+    return 1;
+}
+
+#endif /* TRIPLEBUF_H */
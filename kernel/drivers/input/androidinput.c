@@ -15,14 +15,27 @@
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/input.h>
+#include <linux/input/mt.h>
 #include <linux/delay.h>
 #include <linux/interrupt.h>
 #include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/androidinput.h>
 
 #define __UNUSED __attribute__((unused))
 
-#define X_AXIS_MAX		640
-#define Y_AXIS_MAX		480
+/* Touch coordinate ranges, normally the size of the display */
+static int x_max = 640;
+module_param(x_max, int, 0);
+static int y_max = 480;
+module_param(y_max, int, 0);
+
+/* Multitouch slots, 0 for a single touch device */
+static int max_contacts = 10;
+module_param(max_contacts, int, 0);
 
 static unsigned int keycode_list[KEY_MAX]; /* allow all keycodes */
 
@@ -33,6 +46,11 @@ struct android_input {
 	spinlock_t lock;
 };
 
+/* The one device the bulk injection device feeds, protected by
+   android_input_mutex so it can't go away under a writer */
+static struct android_input *android_input_dev;
+static DEFINE_MUTEX(android_input_mutex);
+
 #ifdef CONFIG_INPUT_ANDROID
 struct platform_device android_input_device = {
 	.name	= "android-input",
@@ -40,6 +58,113 @@ struct platform_device android_input_device = {
 };
 #endif /* CONFIG_INPUT_ANDROID */
 
+/*
+ * Bulk injection, see include/linux/androidinput.h
+ */
+
+static long android_input_inject(const struct android_input_event __user *ubuf,
+				 size_t count)
+{
+	struct android_input *android_input;
+	struct android_input_event *events;
+	unsigned long flags;
+	size_t i, n;
+
+	if (count == 0)
+		return 0;
+
+	count = min_t(size_t, count, ANDROID_INPUT_BATCH_MAX);
+	events = kmalloc(count * sizeof(*events), GFP_KERNEL);
+	if (!events)
+		return -ENOMEM;
+
+	if (copy_from_user(events, ubuf, count * sizeof(*events))) {
+		kfree(events);
+		return -EFAULT;
+	}
+
+	mutex_lock(&android_input_mutex);
+	android_input = android_input_dev;
+	if (!android_input) {
+		mutex_unlock(&android_input_mutex);
+		kfree(events);
+		return -ENODEV;
+	}
+
+	/* Leave a frame cut short by the batch limit to the next call */
+	n = count;
+	while (n > 0 && !(events[n - 1].type == EV_SYN &&
+			  events[n - 1].code == SYN_REPORT))
+		n--;
+	if (n == 0)
+		n = count;
+
+	spin_lock_irqsave(&android_input->lock, flags);
+	for (i = 0; i < n; i++)
+		input_event(android_input->input, events[i].type,
+			    events[i].code, events[i].value);
+	if (events[n - 1].type != EV_SYN || events[n - 1].code != SYN_REPORT)
+		input_sync(android_input->input);
+	spin_unlock_irqrestore(&android_input->lock, flags);
+	mutex_unlock(&android_input_mutex);
+
+	kfree(events);
+	return n;
+}
+
+static ssize_t android_input_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	long n;
+
+	if (count % sizeof(struct android_input_event))
+		return -EINVAL;
+
+	n = android_input_inject((const void __user *)buf,
+				 count / sizeof(struct android_input_event));
+	if (n < 0)
+		return n;
+	return n * sizeof(struct android_input_event);
+}
+
+static long android_input_ioctl(struct file *file, unsigned int cmd,
+				unsigned long arg)
+{
+	struct android_input_inject __user *argp = (void __user *)arg;
+	struct android_input_inject inject;
+	long n;
+
+	if (cmd != ANDROID_INPUT_INJECT)
+		return -ENOTTY;
+
+	if (copy_from_user(&inject, argp, sizeof(inject)))
+		return -EFAULT;
+
+	n = android_input_inject(
+		(const void __user *)(unsigned long)inject.events, inject.count);
+	if (n < 0)
+		return n;
+
+	inject.consumed = n;
+	if (copy_to_user(argp, &inject, sizeof(inject)))
+		return -EFAULT;
+	return 0;
+}
+
+static const struct file_operations android_input_fops = {
+	.owner		= THIS_MODULE,
+	.write		= android_input_write,
+	.unlocked_ioctl	= android_input_ioctl,
+	.compat_ioctl	= android_input_ioctl,
+};
+
+static struct miscdevice android_input_misc = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= "android_input",
+	.fops	= &android_input_fops,
+};
+static int android_input_misc_registered;
+
 static int __devinit android_input_probe(struct platform_device *pdev) 
 {
 	int i;
@@ -80,8 +205,19 @@ static int __devinit android_input_probe(struct platform_device *pdev)
 	input_dev->keybit[BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH);
 	input_set_capability(input_dev, EV_ABS, ABS_X);
 	input_set_capability(input_dev, EV_ABS, ABS_Y);
-	input_set_abs_params(input_dev, ABS_X, 0, X_AXIS_MAX, 0, 0);
-	input_set_abs_params(input_dev, ABS_Y, 0, Y_AXIS_MAX, 0, 0);
+	input_set_abs_params(input_dev, ABS_X, 0, x_max, 0, 0);
+	input_set_abs_params(input_dev, ABS_Y, 0, y_max, 0, 0);
+
+	/* Multitouch protocol B, ABS_X/ABS_Y above follow the first contact */
+	if (max_contacts > 0) {
+		error = input_mt_init_slots(input_dev, max_contacts);
+		if (error)
+			goto fail;
+		input_set_abs_params(input_dev, ABS_MT_POSITION_X, 0, x_max, 0, 0);
+		input_set_abs_params(input_dev, ABS_MT_POSITION_Y, 0, y_max, 0, 0);
+		input_set_abs_params(input_dev, ABS_MT_TRACKING_ID,
+				     0, 0xffff, 0, 0);
+	}
 	
 	input_dev->keycode = android_input->keycode;
 	input_dev->keycodesize = sizeof(unsigned int);
@@ -105,6 +241,16 @@ static int __devinit android_input_probe(struct platform_device *pdev)
 		goto fail;
 	}
 
+	mutex_lock(&android_input_mutex);
+	android_input_dev = android_input;
+	mutex_unlock(&android_input_mutex);
+
+	/* Not fatal, evdev still works */
+	if (misc_register(&android_input_misc))
+		printk(KERN_WARNING "android-input: No bulk injection device\n");
+	else
+		android_input_misc_registered = 1;
+
 	printk(KERN_INFO "android-input: Registered\n");
 
 	return 0;
@@ -121,6 +267,14 @@ static int __devexit android_input_remove(struct platform_device *dev)
 {
 	struct android_input *android_input = platform_get_drvdata(dev);
 
+	if (android_input_misc_registered) {
+		misc_deregister(&android_input_misc);
+		android_input_misc_registered = 0;
+	}
+	mutex_lock(&android_input_mutex);
+	android_input_dev = NULL;
+	mutex_unlock(&android_input_mutex);
+
 	input_unregister_device(android_input->input);
 
 	kfree(android_input);
@@ -17,11 +17,18 @@
 #include <asm/mach/time.h>
 #endif
 #include <linux/android_alarm.h>
+#include <linux/android_alarm_batch.h>
+#include <linux/android_alarm_time.h>
 #include <linux/device.h>
 #include <linux/miscdevice.h>
 #include <linux/fs.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
 #include <linux/platform_device.h>
+#include <linux/rbtree.h>
 #include <linux/sched.h>
+#include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/sysdev.h>
 #include <linux/uaccess.h>
@@ -49,15 +56,204 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 #define ANDROID_ALARM_SET_OLD               _IOW('a', 2, time_t) /* set alarm */
 #define ANDROID_ALARM_SET_AND_WAIT_OLD      _IOW('a', 3, time_t)
 
-static int alarm_opened;
-static DEFINE_SPINLOCK(alarm_slock);
-static struct wake_lock alarm_wake_lock;
-static DECLARE_WAIT_QUEUE_HEAD(alarm_wait_queue);
-static uint32_t alarm_pending;
-static uint32_t alarm_enabled;
-static uint32_t wait_pending;
+static int max_alarms = 1024;
+module_param_named(max_alarms, max_alarms, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
-static struct alarm alarms[ANDROID_ALARM_TYPE_COUNT];
+struct alarm_entry {
+	struct alarm alarm;
+	struct alarm_client *client;
+	bool enabled;			/* under client->lock */
+	bool in_set;
+	uint32_t id;
+	struct rb_node node;		/* in client->set */
+	struct list_head fired;		/* on client->fired */
+};
+
+/*
+ * Every open file is a client with its own alarms: one per type for the
+ * single alarm ioctls, and a set of them by id for ANDROID_ALARM_BATCH.
+ *
+ * mutex orders the calls into alarm.c made by set, clear and release.
+ * lock only covers the state shared with alarm_triggered() and is never
+ * held across a call into alarm.c, so it doesn't nest with alarm.c's
+ * queue locks.
+ */
+struct alarm_client {
+	struct mutex mutex;
+	spinlock_t lock;
+	struct wake_lock wake_lock;
+	wait_queue_head_t wait_queue;
+	uint32_t pending;		/* under lock */
+	uint32_t wait_pending;		/* under lock */
+	struct list_head fired;		/* under lock, set alarms gone off */
+	struct rb_root set;		/* under mutex, by id */
+	int nset;			/* under mutex */
+	struct list_head link;		/* on alarm_clients */
+	struct alarm_entry single[ANDROID_ALARM_TYPE_COUNT];
+};
+
+/* Clients to tell when the wall time changes */
+static LIST_HEAD(alarm_clients);
+static DEFINE_MUTEX(alarm_clients_mutex);
+
+static void alarm_triggered(struct alarm *alarm);
+
+static void alarm_entry_init(struct alarm_entry *entry,
+			     struct alarm_client *client,
+			     enum android_alarm_type type)
+{
+	alarm_init(&entry->alarm, type, alarm_triggered);
+	entry->client = client;
+	entry->enabled = false;
+	INIT_LIST_HEAD(&entry->fired);
+}
+
+/* Stop entry from going off, waiting for its callback if it runs. Called
+ * with client->mutex held. Returns alarm_cancel()'s result. */
+static int alarm_entry_stop(struct alarm_entry *entry)
+{
+	struct alarm_client *client = entry->client;
+	uint32_t alarm_type_mask = 1U << entry->alarm.type;
+	unsigned long flags;
+
+	spin_lock_irqsave(&client->lock, flags);
+	entry->enabled = false;
+	list_del_init(&entry->fired);
+	if (!entry->in_set && client->pending) {
+		client->pending &= ~alarm_type_mask;
+		if (!client->pending && !client->wait_pending)
+			wake_unlock(&client->wake_lock);
+	}
+	spin_unlock_irqrestore(&client->lock, flags);
+	/* Disabled first, so if it fires meanwhile nothing happens */
+	return alarm_cancel(&entry->alarm);
+}
+
+static void alarm_entry_start(struct alarm_entry *entry, ktime_t expires)
+{
+	struct alarm_client *client = entry->client;
+	unsigned long flags;
+
+	spin_lock_irqsave(&client->lock, flags);
+	entry->enabled = true;
+	list_del_init(&entry->fired);
+	spin_unlock_irqrestore(&client->lock, flags);
+	alarm_start_range(&entry->alarm, expires, expires);
+}
+
+/* Find id in the client's set, or where to link it. Called with
+ * client->mutex held. */
+static struct alarm_entry *alarm_set_find(struct alarm_client *client,
+					  uint32_t id,
+					  struct rb_node ***linkp,
+					  struct rb_node **parentp)
+{
+	struct rb_node **link = &client->set.rb_node;
+	struct rb_node *parent = NULL;
+	struct alarm_entry *entry;
+
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct alarm_entry, node);
+		if (id < entry->id)
+			link = &(*link)->rb_left;
+		else if (id > entry->id)
+			link = &(*link)->rb_right;
+		else
+			return entry;
+	}
+	*linkp = link;
+	*parentp = parent;
+	return NULL;
+}
+
+static int alarm_set_apply(struct alarm_client *client,
+			   struct android_alarm_req *req)
+{
+	struct rb_node **link;
+	struct rb_node *parent;
+	struct alarm_entry *entry;
+	int ret;
+
+	entry = alarm_set_find(client, req->id, &link, &parent);
+
+	switch (req->op) {
+	case ANDROID_ALARM_BATCH_SET:
+		if (req->type >= ANDROID_ALARM_TYPE_COUNT ||
+		    req->tv_nsec >= NSEC_PER_SEC)
+			return -EINVAL;
+		if (!entry) {
+			if (client->nset >= max_alarms)
+				return -ENOSPC;
+			entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+			if (!entry)
+				return -ENOMEM;
+			alarm_entry_init(entry, client, req->type);
+			entry->in_set = true;
+			entry->id = req->id;
+			rb_link_node(&entry->node, parent, link);
+			rb_insert_color(&entry->node, &client->set);
+			client->nset++;
+		} else if (entry->alarm.type != req->type) {
+			alarm_entry_stop(entry);
+			alarm_entry_init(entry, client, req->type);
+		}
+		pr_alarm(IO, "alarm %u type %u set %lld.%09u\n", req->id,
+			req->type, req->tv_sec, req->tv_nsec);
+		alarm_entry_start(entry, ktime_set(req->tv_sec, req->tv_nsec));
+		return 0;
+
+	case ANDROID_ALARM_BATCH_CANCEL:
+		if (!entry)
+			return 0;
+		pr_alarm(IO, "alarm %u cancel\n", req->id);
+		ret = alarm_entry_stop(entry);
+		rb_erase(&entry->node, &client->set);
+		client->nset--;
+		kfree(entry);
+		return ret;
+	}
+	return -EINVAL;
+}
+
+static int alarm_batch(struct alarm_client *client,
+		       struct android_alarm_batch __user *ubatch)
+{
+	struct android_alarm_batch batch;
+	struct android_alarm_req *reqs;
+	void __user *ureqs;
+	size_t size;
+	int rv = 0;
+	int i;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (batch.count > ANDROID_ALARM_BATCH_MAX)
+		return -EINVAL;
+	if (!batch.count)
+		return 0;
+
+	ureqs = (void __user *)(unsigned long)batch.reqs;
+	size = batch.count * sizeof(*reqs);
+	reqs = kmalloc(size, GFP_KERNEL);
+	if (!reqs)
+		return -ENOMEM;
+	if (copy_from_user(reqs, ureqs, size)) {
+		rv = -EFAULT;
+		goto err;
+	}
+
+	mutex_lock(&client->mutex);
+	for (i = 0; i < batch.count; i++)
+		reqs[i].result = alarm_set_apply(client, &reqs[i]);
+	mutex_unlock(&client->mutex);
+
+	if (copy_to_user(ureqs, reqs, size))
+		rv = -EFAULT;
+err:
+	kfree(reqs);
+	return rv;
+}
 
 static long alarm_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
@@ -66,8 +262,9 @@ static long alarm_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct timespec new_alarm_time;
 	struct timespec new_rtc_time;
 	struct timespec tmp_time;
+	struct alarm_client *client = file->private_data;
+	struct alarm_client *other;
 	enum android_alarm_type alarm_type = ANDROID_ALARM_IOCTL_TO_TYPE(cmd);
-	uint32_t alarm_type_mask = 1U << alarm_type;
 
 	if (alarm_type >= ANDROID_ALARM_TYPE_COUNT)
 		return -EINVAL;
@@ -75,31 +272,14 @@ static long alarm_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	if (ANDROID_ALARM_BASE_CMD(cmd) != ANDROID_ALARM_GET_TIME(0)) {
 		if ((file->f_flags & O_ACCMODE) == O_RDONLY)
 			return -EPERM;
-		if (file->private_data == NULL &&
-		    cmd != ANDROID_ALARM_SET_RTC) {
-			spin_lock_irqsave(&alarm_slock, flags);
-			if (alarm_opened) {
-				spin_unlock_irqrestore(&alarm_slock, flags);
-				return -EBUSY;
-			}
-			alarm_opened = 1;
-			file->private_data = (void *)1;
-			spin_unlock_irqrestore(&alarm_slock, flags);
-		}
 	}
 
 	switch (ANDROID_ALARM_BASE_CMD(cmd)) {
 	case ANDROID_ALARM_CLEAR(0):
-		spin_lock_irqsave(&alarm_slock, flags);
+		mutex_lock(&client->mutex);
 		pr_alarm(IO, "alarm %d clear\n", alarm_type);
-		alarm_try_to_cancel(&alarms[alarm_type]);
-		if (alarm_pending) {
-			alarm_pending &= ~alarm_type_mask;
-			if (!alarm_pending && !wait_pending)
-				wake_unlock(&alarm_wake_lock);
-		}
-		alarm_enabled &= ~alarm_type_mask;
-		spin_unlock_irqrestore(&alarm_slock, flags);
+		alarm_entry_stop(&client->single[alarm_type]);
+		mutex_unlock(&client->mutex);
 		break;
 
 	case ANDROID_ALARM_SET_OLD:
@@ -119,34 +299,33 @@ static long alarm_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			goto err1;
 		}
 from_old_alarm_set:
-		spin_lock_irqsave(&alarm_slock, flags);
+		mutex_lock(&client->mutex);
 		pr_alarm(IO, "alarm %d set %ld.%09ld\n", alarm_type,
 			new_alarm_time.tv_sec, new_alarm_time.tv_nsec);
-		alarm_enabled |= alarm_type_mask;
-		alarm_start_range(&alarms[alarm_type],
-			timespec_to_ktime(new_alarm_time),
+		alarm_entry_start(&client->single[alarm_type],
 			timespec_to_ktime(new_alarm_time));
-		spin_unlock_irqrestore(&alarm_slock, flags);
+		mutex_unlock(&client->mutex);
 		if (ANDROID_ALARM_BASE_CMD(cmd) != ANDROID_ALARM_SET_AND_WAIT(0)
 		    && cmd != ANDROID_ALARM_SET_AND_WAIT_OLD)
 			break;
 		/* fall though */
 	case ANDROID_ALARM_WAIT:
-		spin_lock_irqsave(&alarm_slock, flags);
+		spin_lock_irqsave(&client->lock, flags);
 		pr_alarm(IO, "alarm wait\n");
-		if (!alarm_pending && wait_pending) {
-			wake_unlock(&alarm_wake_lock);
-			wait_pending = 0;
+		if (!client->pending && client->wait_pending) {
+			wake_unlock(&client->wake_lock);
+			client->wait_pending = 0;
 		}
-		spin_unlock_irqrestore(&alarm_slock, flags);
-		rv = wait_event_interruptible(alarm_wait_queue, alarm_pending);
+		spin_unlock_irqrestore(&client->lock, flags);
+		rv = wait_event_interruptible(client->wait_queue,
+					      client->pending);
 		if (rv)
 			goto err1;
-		spin_lock_irqsave(&alarm_slock, flags);
-		rv = alarm_pending;
-		wait_pending = 1;
-		alarm_pending = 0;
-		spin_unlock_irqrestore(&alarm_slock, flags);
+		spin_lock_irqsave(&client->lock, flags);
+		rv = client->pending;
+		client->wait_pending = 1;
+		client->pending = 0;
+		spin_unlock_irqrestore(&client->lock, flags);
 		break;
 	case ANDROID_ALARM_SET_RTC:
 		if (copy_from_user(&new_rtc_time, (void __user *)arg,
@@ -155,10 +334,14 @@ from_old_alarm_set:
 			goto err1;
 		}
 		rv = alarm_set_rtc(new_rtc_time);
-		spin_lock_irqsave(&alarm_slock, flags);
-		alarm_pending |= ANDROID_ALARM_TIME_CHANGE_MASK;
-		wake_up(&alarm_wait_queue);
-		spin_unlock_irqrestore(&alarm_slock, flags);
+		mutex_lock(&alarm_clients_mutex);
+		list_for_each_entry(other, &alarm_clients, link) {
+			spin_lock_irqsave(&other->lock, flags);
+			other->pending |= ANDROID_ALARM_TIME_CHANGE_MASK;
+			wake_up(&other->wait_queue);
+			spin_unlock_irqrestore(&other->lock, flags);
+		}
+		mutex_unlock(&alarm_clients_mutex);
 		if (rv < 0)
 			goto err1;
 		break;
@@ -184,6 +367,9 @@ from_old_alarm_set:
 			goto err1;
 		}
 		break;
+	case ANDROID_ALARM_BATCH:
+		rv = alarm_batch(client, (void __user *)arg);
+		break;
 
 	default:
 		rv = -EINVAL;
@@ -193,64 +379,143 @@ err1:
 	return rv;
 }
 
+/* The ids of the set alarms that went off since the last read */
+static ssize_t alarm_read(struct file *file, char __user *buf, size_t count,
+			  loff_t *ppos)
+{
+	struct alarm_client *client = file->private_data;
+	struct alarm_entry *entry;
+	uint32_t ids[16];
+	unsigned long flags;
+	size_t done = 0;
+	int n;
+
+	while (done + sizeof(ids[0]) <= count) {
+		n = 0;
+		spin_lock_irqsave(&client->lock, flags);
+		while (n < ARRAY_SIZE(ids) &&
+		       done + (n + 1) * sizeof(ids[0]) <= count &&
+		       !list_empty(&client->fired)) {
+			entry = list_first_entry(&client->fired,
+						 struct alarm_entry, fired);
+			list_del_init(&entry->fired);
+			ids[n++] = entry->id;
+		}
+		spin_unlock_irqrestore(&client->lock, flags);
+		if (!n)
+			break;
+		if (copy_to_user(buf + done, ids, n * sizeof(ids[0])))
+			return -EFAULT;
+		done += n * sizeof(ids[0]);
+	}
+	return done;
+}
+
+/* Map the elapsed realtime time page, read only */
+static int alarm_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct page *page = alarm_time_page();
+
+	if (!page)
+		return -ENODEV;
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       page_to_pfn(page),
+			       PAGE_SIZE, vma->vm_page_prot);
+}
+
 static int alarm_open(struct inode *inode, struct file *file)
 {
-	file->private_data = NULL;
+	struct alarm_client *client;
+	int i;
+
+	client = kzalloc(sizeof(*client), GFP_KERNEL);
+	if (!client)
+		return -ENOMEM;
+
+	mutex_init(&client->mutex);
+	spin_lock_init(&client->lock);
+	wake_lock_init(&client->wake_lock, WAKE_LOCK_SUSPEND, "alarm");
+	init_waitqueue_head(&client->wait_queue);
+	INIT_LIST_HEAD(&client->fired);
+	client->set = RB_ROOT;
+	for (i = 0; i < ANDROID_ALARM_TYPE_COUNT; i++)
+		alarm_entry_init(&client->single[i], client, i);
+
+	mutex_lock(&alarm_clients_mutex);
+	list_add(&client->link, &alarm_clients);
+	mutex_unlock(&alarm_clients_mutex);
+
+	file->private_data = client;
 	return 0;
 }
 
 static int alarm_release(struct inode *inode, struct file *file)
 {
+	struct alarm_client *client = file->private_data;
+	struct alarm_entry *entry;
+	struct rb_node *node;
 	int i;
-	unsigned long flags;
 
-	spin_lock_irqsave(&alarm_slock, flags);
-	if (file->private_data != 0) {
-		for (i = 0; i < ANDROID_ALARM_TYPE_COUNT; i++) {
-			uint32_t alarm_type_mask = 1U << i;
-			if (alarm_enabled & alarm_type_mask) {
-				pr_alarm(INFO, "alarm_release: clear alarm, "
-					"pending %d\n",
-					!!(alarm_pending & alarm_type_mask));
-				alarm_enabled &= ~alarm_type_mask;
-			}
-			spin_unlock_irqrestore(&alarm_slock, flags);
-			alarm_cancel(&alarms[i]);
-			spin_lock_irqsave(&alarm_slock, flags);
-		}
-		if (alarm_pending | wait_pending) {
-			if (alarm_pending)
-				pr_alarm(INFO, "alarm_release: clear "
-					"pending alarms %x\n", alarm_pending);
-			wake_unlock(&alarm_wake_lock);
-			wait_pending = 0;
-			alarm_pending = 0;
-		}
-		alarm_opened = 0;
+	mutex_lock(&alarm_clients_mutex);
+	list_del(&client->link);
+	mutex_unlock(&alarm_clients_mutex);
+
+	mutex_lock(&client->mutex);
+	for (i = 0; i < ANDROID_ALARM_TYPE_COUNT; i++) {
+		if (client->single[i].enabled)
+			pr_alarm(INFO, "alarm_release: clear alarm %d\n", i);
+		alarm_entry_stop(&client->single[i]);
+	}
+	while ((node = rb_first(&client->set))) {
+		entry = rb_entry(node, struct alarm_entry, node);
+		alarm_entry_stop(entry);
+		rb_erase(node, &client->set);
+		kfree(entry);
 	}
-	spin_unlock_irqrestore(&alarm_slock, flags);
+	if (client->pending)
+		pr_alarm(INFO, "alarm_release: clear pending alarms %x\n",
+			client->pending);
+	mutex_unlock(&client->mutex);
+
+	/* Nothing can go off anymore */
+	wake_unlock(&client->wake_lock);
+	wake_lock_destroy(&client->wake_lock);
+	kfree(client);
 	return 0;
 }
 
 static void alarm_triggered(struct alarm *alarm)
 {
+	struct alarm_entry *entry = container_of(alarm, struct alarm_entry,
+						 alarm);
+	struct alarm_client *client = entry->client;
 	unsigned long flags;
 	uint32_t alarm_type_mask = 1U << alarm->type;
 
 	pr_alarm(INT, "alarm_triggered type %d\n", alarm->type);
-	spin_lock_irqsave(&alarm_slock, flags);
-	if (alarm_enabled & alarm_type_mask) {
-		wake_lock_timeout(&alarm_wake_lock, 5 * HZ);
-		alarm_enabled &= ~alarm_type_mask;
-		alarm_pending |= alarm_type_mask;
-		wake_up(&alarm_wait_queue);
+	spin_lock_irqsave(&client->lock, flags);
+	if (entry->enabled) {
+		wake_lock_timeout(&client->wake_lock, 5 * HZ);
+		entry->enabled = false;
+		client->pending |= alarm_type_mask;
+		if (entry->in_set)
+			list_add_tail(&entry->fired, &client->fired);
+		wake_up(&client->wait_queue);
 	}
-	spin_unlock_irqrestore(&alarm_slock, flags);
+	spin_unlock_irqrestore(&client->lock, flags);
 }
 
 static const struct file_operations alarm_fops = {
 	.owner = THIS_MODULE,
 	.unlocked_ioctl = alarm_ioctl,
+	.read = alarm_read,
+	.mmap = alarm_mmap,
 	.open = alarm_open,
 	.release = alarm_release,
 };
@@ -263,24 +528,12 @@ static struct miscdevice alarm_device = {
 
 static int __init alarm_dev_init(void)
 {
-	int err;
-	int i;
-
-	err = misc_register(&alarm_device);
-	if (err)
-		return err;
-
-	for (i = 0; i < ANDROID_ALARM_TYPE_COUNT; i++)
-		alarm_init(&alarms[i], i, alarm_triggered);
-	wake_lock_init(&alarm_wake_lock, WAKE_LOCK_SUSPEND, "alarm");
-
-	return 0;
+	return misc_register(&alarm_device);
 }
 
 static void  __exit alarm_dev_exit(void)
 {
 	misc_deregister(&alarm_device);
-	wake_lock_destroy(&alarm_wake_lock);
 }
 
 module_init(alarm_dev_init);
@@ -17,13 +17,18 @@
 #include <asm/mach/time.h>
 #endif
 #include <linux/android_alarm.h>
+#include <linux/android_alarm_time.h>
 #include <linux/device.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
 #include <linux/miscdevice.h>
 #include <linux/platform_device.h>
 #include <linux/rtc.h>
 #include <linux/sched.h>
+#include <linux/seqlock.h>
 #include <linux/spinlock.h>
 #include <linux/sysdev.h>
+#include <linux/wait.h>
 #include <linux/wakelock.h>
 
 #define ANDROID_ALARM_PRINT_ERROR (1U << 0)
@@ -38,6 +43,25 @@ static int debug_mask = ANDROID_ALARM_PRINT_ERROR | \
 			ANDROID_ALARM_PRINT_INIT_STATUS;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/*
+ * How late an alarm may run so that it shares a wakeup with others. Each
+ * queue's timer is armed with the window softexpires..expires + slack and
+ * the hrtimer interrupt runs every timer whose window has opened, so
+ * alarms of all queues that overlap go off together. 0 disables it.
+ */
+static ulong coalesce_slack_ns;
+module_param_named(coalesce_slack_ns, coalesce_slack_ns, ulong,
+		   S_IRUGO | S_IWUSR | S_IWGRP);
+
+/* Per type, under the queue lock: timer firings, and alarms the slack
+ * let ride on a later firing. Those were past their expiry but not yet
+ * at expiry + slack, so without the slack they would have had a firing
+ * of their own. Always 0 with coalesce_slack_ns at 0. */
+static unsigned int alarm_fired[ANDROID_ALARM_TYPE_COUNT];
+module_param_array_named(fired, alarm_fired, uint, NULL, S_IRUGO);
+static unsigned int alarm_coalesced[ANDROID_ALARM_TYPE_COUNT];
+module_param_array_named(coalesced, alarm_coalesced, uint, NULL, S_IRUGO);
+
 #define pr_alarm(debug_level_mask, args...) \
 	do { \
 		if (debug_mask & ANDROID_ALARM_PRINT_##debug_level_mask) { \
@@ -53,30 +77,96 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 #define ANDROID_ALARM_SET_OLD               _IOW('a', 2, time_t) /* set alarm */
 #define ANDROID_ALARM_SET_AND_WAIT_OLD      _IOW('a', 3, time_t)
 
+/*
+ * Each queue has its own lock for its alarms and timer. The time base,
+ * delta and stopped, is shared by all queues and changes only when the
+ * wall time is set, so it is published under alarm_time_lock instead
+ * and read without taking any queue lock.
+ */
 struct alarm_queue {
+	spinlock_t lock;
 	struct rb_root alarms;
 	struct rb_node *first;
 	struct hrtimer timer;
-	ktime_t delta;
-	bool stopped;
-	ktime_t stopped_time;
+	ktime_t delta;			/* under alarm_time_lock */
+	bool stopped;			/* under alarm_time_lock */
+	ktime_t stopped_time;		/* under alarm_time_lock */
+	struct alarm *running;		/* callback in progress */
+	wait_queue_head_t running_wait;	/* woken when it returns */
 };
 
 static struct rtc_device *alarm_rtc_dev;
-static DEFINE_SPINLOCK(alarm_slock);
+static DEFINE_SEQLOCK(alarm_time_lock);
 static DEFINE_MUTEX(alarm_setrtc_mutex);
 static struct wake_lock alarm_rtc_wake_lock;
 static struct platform_device *alarm_platform_dev;
 struct alarm_queue alarms[ANDROID_ALARM_TYPE_COUNT];
-static bool suspended;
+static bool suspended;		/* under both wakeup queue locks */
+static struct android_alarm_time *alarm_time;	/* mapped by alarm-dev */
+
+/* Mirror the elapsed realtime base to the page userspace maps, if the
+ * driver got one. Called with alarm_time_lock held for writing. */
+static void alarm_publish_time_locked(void)
+{
+	struct alarm_queue *base = &alarms[ANDROID_ALARM_ELAPSED_REALTIME];
+
+	if (!alarm_time)
+		return;
+
+	alarm_time->seq++;
+	smp_wmb();
+	alarm_time->stopped = base->stopped;
+	alarm_time->delta_ns = ktime_to_ns(base->delta);
+	alarm_time->stopped_ns = ktime_to_ns(base->stopped_time);
+	smp_wmb();
+	alarm_time->seq++;
+}
+
+struct page *alarm_time_page(void)
+{
+	return alarm_time ? virt_to_page(alarm_time) : NULL;
+}
+
+/* Consistent snapshot of a queue's time base. Returns stopped. */
+static bool alarm_read_time_base(struct alarm_queue *base, ktime_t *delta,
+				 ktime_t *stopped_time)
+{
+	unsigned seq;
+	bool stopped;
+
+	do {
+		seq = read_seqbegin(&alarm_time_lock);
+		stopped = base->stopped;
+		*delta = base->delta;
+		*stopped_time = base->stopped_time;
+	} while (read_seqretry(&alarm_time_lock, seq));
+
+	return stopped;
+}
+
+/* suspended is only looked at by the wakeup queues, so it is written
+ * holding both of their locks */
+static void alarm_wakeup_lock(unsigned long *flags)
+{
+	spin_lock_irqsave(&alarms[ANDROID_ALARM_RTC_WAKEUP].lock, *flags);
+	spin_lock_nested(&alarms[ANDROID_ALARM_ELAPSED_REALTIME_WAKEUP].lock,
+			 SINGLE_DEPTH_NESTING);
+}
+
+static void alarm_wakeup_unlock(unsigned long flags)
+{
+	spin_unlock(&alarms[ANDROID_ALARM_ELAPSED_REALTIME_WAKEUP].lock);
+	spin_unlock_irqrestore(&alarms[ANDROID_ALARM_RTC_WAKEUP].lock, flags);
+}
 
 static void update_timer_locked(struct alarm_queue *base, bool head_removed)
 {
 	struct alarm *alarm;
+	ktime_t delta, stopped_time;
 	bool is_wakeup = base == &alarms[ANDROID_ALARM_RTC_WAKEUP] ||
 			base == &alarms[ANDROID_ALARM_ELAPSED_REALTIME_WAKEUP];
 
-	if (base->stopped) {
+	if (alarm_read_time_base(base, &delta, &stopped_time)) {
 		pr_alarm(FLOW, "changed alarm while setting the wall time\n");
 		return;
 	}
@@ -99,8 +189,9 @@ static void update_timer_locked(struct alarm_queue *base, bool head_removed)
 	}
 
 	hrtimer_try_to_cancel(&base->timer);
-	base->timer._expires = ktime_add(base->delta, alarm->expires);
-	base->timer._softexpires = ktime_add(base->delta, alarm->softexpires);
+	base->timer._expires = ktime_add_ns(ktime_add(delta, alarm->expires),
+					    ACCESS_ONCE(coalesce_slack_ns));
+	base->timer._softexpires = ktime_add(delta, alarm->softexpires);
 	hrtimer_start_expires(&base->timer, HRTIMER_MODE_ABS);
 }
 
@@ -173,13 +264,14 @@ void alarm_init(struct alarm *alarm,
  */
 void alarm_start_range(struct alarm *alarm, ktime_t start, ktime_t end)
 {
+	struct alarm_queue *base = &alarms[alarm->type];
 	unsigned long flags;
 
-	spin_lock_irqsave(&alarm_slock, flags);
+	spin_lock_irqsave(&base->lock, flags);
 	alarm->softexpires = start;
 	alarm->expires = end;
 	alarm_enqueue_locked(alarm);
-	spin_unlock_irqrestore(&alarm_slock, flags);
+	spin_unlock_irqrestore(&base->lock, flags);
 }
 
 /**
@@ -189,8 +281,8 @@ void alarm_start_range(struct alarm *alarm, ktime_t start, ktime_t end)
  * Returns:
  *  0 when the alarm was not active
  *  1 when the alarm was active
- * -1 when the alarm may currently be excuting the callback function and
- *    cannot be stopped (it may also be inactive)
+ * -1 when the alarm is currently excuting the callback function and
+ *    cannot be stopped
  */
 int alarm_try_to_cancel(struct alarm *alarm)
 {
@@ -199,7 +291,7 @@ int alarm_try_to_cancel(struct alarm *alarm)
 	bool first = false;
 	int ret = 0;
 
-	spin_lock_irqsave(&alarm_slock, flags);
+	spin_lock_irqsave(&base->lock, flags);
 	if (!RB_EMPTY_NODE(&alarm->node)) {
 		pr_alarm(FLOW, "canceled alarm, type %d, func %pF at %lld\n",
 			alarm->type, alarm->function,
@@ -216,9 +308,9 @@ int alarm_try_to_cancel(struct alarm *alarm)
 	} else
 		pr_alarm(FLOW, "tried to cancel alarm, type %d, func %pF\n",
 			alarm->type, alarm->function);
-	spin_unlock_irqrestore(&alarm_slock, flags);
-	if (!ret && hrtimer_callback_running(&base->timer))
+	if (!ret && base->running == alarm)
 		ret = -1;
+	spin_unlock_irqrestore(&base->lock, flags);
 	return ret;
 }
 
@@ -226,17 +318,24 @@ int alarm_try_to_cancel(struct alarm *alarm)
  * alarm_cancel - cancel an alarm and wait for the handler to finish.
  * @alarm:	the alarm to be cancelled
  *
+ * Sleeps while the handler runs, where it used to spin. Calling it from
+ * atomic context is therefore a bug now, as is calling it from the
+ * alarm's own handler; use alarm_try_to_cancel() there.
+ *
  * Returns:
  *  0 when the alarm was not active
  *  1 when the alarm was active
  */
 int alarm_cancel(struct alarm *alarm)
 {
+	struct alarm_queue *base = &alarms[alarm->type];
+
 	for (;;) {
 		int ret = alarm_try_to_cancel(alarm);
 		if (ret >= 0)
 			return ret;
-		cpu_relax();
+		wait_event(base->running_wait,
+			   ACCESS_ONCE(base->running) != alarm);
 	}
 }
 
@@ -262,11 +361,10 @@ int alarm_set_rtc(struct timespec new_time)
 		rtc_new_rtc_time.tm_year + 1900);
 
 	mutex_lock(&alarm_setrtc_mutex);
-	spin_lock_irqsave(&alarm_slock, flags);
 	wake_lock(&alarm_rtc_wake_lock);
+	write_seqlock_irqsave(&alarm_time_lock, flags);
 	getnstimeofday(&tmp_time);
 	for (i = 0; i < ANDROID_ALARM_SYSTEMTIME; i++) {
-		hrtimer_try_to_cancel(&alarms[i].timer);
 		alarms[i].stopped = true;
 		alarms[i].stopped_time = timespec_to_ktime(tmp_time);
 	}
@@ -274,14 +372,25 @@ int alarm_set_rtc(struct timespec new_time)
 		alarms[ANDROID_ALARM_ELAPSED_REALTIME].delta =
 		ktime_sub(alarms[ANDROID_ALARM_ELAPSED_REALTIME].delta,
 			timespec_to_ktime(timespec_sub(tmp_time, new_time)));
-	spin_unlock_irqrestore(&alarm_slock, flags);
-	ret = do_settimeofday(&new_time);
-	spin_lock_irqsave(&alarm_slock, flags);
+	alarm_publish_time_locked();
+	write_sequnlock_irqrestore(&alarm_time_lock, flags);
+	/* Stopped queues no longer rearm, take down what is armed */
 	for (i = 0; i < ANDROID_ALARM_SYSTEMTIME; i++) {
+		spin_lock_irqsave(&alarms[i].lock, flags);
+		hrtimer_try_to_cancel(&alarms[i].timer);
+		spin_unlock_irqrestore(&alarms[i].lock, flags);
+	}
+	ret = do_settimeofday(&new_time);
+	write_seqlock_irqsave(&alarm_time_lock, flags);
+	for (i = 0; i < ANDROID_ALARM_SYSTEMTIME; i++)
 		alarms[i].stopped = false;
+	alarm_publish_time_locked();
+	write_sequnlock_irqrestore(&alarm_time_lock, flags);
+	for (i = 0; i < ANDROID_ALARM_SYSTEMTIME; i++) {
+		spin_lock_irqsave(&alarms[i].lock, flags);
 		update_timer_locked(&alarms[i], false);
+		spin_unlock_irqrestore(&alarms[i].lock, flags);
 	}
-	spin_unlock_irqrestore(&alarm_slock, flags);
 	if (ret < 0) {
 		pr_alarm(ERROR, "alarm_set_rtc: Failed to set time\n");
 		goto err;
@@ -309,28 +418,34 @@ err:
 ktime_t alarm_get_elapsed_realtime(void)
 {
 	ktime_t now;
-	unsigned long flags;
+	unsigned seq;
 	struct alarm_queue *base = &alarms[ANDROID_ALARM_ELAPSED_REALTIME];
 
-	spin_lock_irqsave(&alarm_slock, flags);
-	now = base->stopped ? base->stopped_time : ktime_get_real();
-	now = ktime_sub(now, base->delta);
-	spin_unlock_irqrestore(&alarm_slock, flags);
+	do {
+		seq = read_seqbegin(&alarm_time_lock);
+		now = base->stopped ? base->stopped_time : ktime_get_real();
+		now = ktime_sub(now, base->delta);
+	} while (read_seqretry(&alarm_time_lock, seq));
 	return now;
 }
 
 static enum hrtimer_restart alarm_timer_triggered(struct hrtimer *timer)
 {
-	struct alarm_queue *base;
+	struct alarm_queue *base = container_of(timer, struct alarm_queue,
+						timer);
 	struct alarm *alarm;
 	unsigned long flags;
-	ktime_t now;
+	ktime_t now, delta, stopped_time;
+	unsigned long slack = ACCESS_ONCE(coalesce_slack_ns);
 
-	spin_lock_irqsave(&alarm_slock, flags);
+	spin_lock_irqsave(&base->lock, flags);
+	alarm_fired[base - alarms]++;
 
-	base = container_of(timer, struct alarm_queue, timer);
-	now = base->stopped ? base->stopped_time : hrtimer_cb_get_time(timer);
-	now = ktime_sub(now, base->delta);
+	if (alarm_read_time_base(base, &delta, &stopped_time))
+		now = stopped_time;
+	else
+		now = hrtimer_cb_get_time(timer);
+	now = ktime_sub(now, delta);
 
 	pr_alarm(INT, "alarm_timer_triggered type %d at %lld\n",
 		base - alarms, ktime_to_ns(now));
@@ -346,18 +461,24 @@ static enum hrtimer_restart alarm_timer_triggered(struct hrtimer *timer)
 		base->first = rb_next(&alarm->node);
 		rb_erase(&alarm->node, &base->alarms);
 		RB_CLEAR_NODE(&alarm->node);
+		if (now.tv64 >= alarm->expires.tv64 &&
+		    now.tv64 < ktime_add_ns(alarm->expires, slack).tv64)
+			alarm_coalesced[base - alarms]++;
 		pr_alarm(CALL, "call alarm, type %d, func %pF, %lld (s %lld)\n",
 			alarm->type, alarm->function,
 			ktime_to_ns(alarm->expires),
 			ktime_to_ns(alarm->softexpires));
-		spin_unlock_irqrestore(&alarm_slock, flags);
+		base->running = alarm;
+		spin_unlock_irqrestore(&base->lock, flags);
 		alarm->function(alarm);
-		spin_lock_irqsave(&alarm_slock, flags);
+		spin_lock_irqsave(&base->lock, flags);
+		base->running = NULL;
+		wake_up_all(&base->running_wait);
 	}
 	if (!base->first)
 		pr_alarm(FLOW, "no more alarms of type %d\n", base - alarms);
 	update_timer_locked(base, true);
-	spin_unlock_irqrestore(&alarm_slock, flags);
+	spin_unlock_irqrestore(&base->lock, flags);
 	return HRTIMER_NORESTART;
 }
 
@@ -385,9 +506,9 @@ static int alarm_suspend(struct platform_device *pdev, pm_message_t state)
 
 	pr_alarm(SUSPEND, "alarm_suspend(%p, %d)\n", pdev, state.event);
 
-	spin_lock_irqsave(&alarm_slock, flags);
+	alarm_wakeup_lock(&flags);
 	suspended = true;
-	spin_unlock_irqrestore(&alarm_slock, flags);
+	alarm_wakeup_unlock(flags);
 
 	hrtimer_cancel(&alarms[ANDROID_ALARM_RTC_WAKEUP].timer);
 	hrtimer_cancel(&alarms[
@@ -428,7 +549,7 @@ static int alarm_suspend(struct platform_device *pdev, pm_message_t state)
 			rtc_alarm.enabled = 0;
 			rtc_set_alarm(alarm_rtc_dev, &rtc_alarm);
 
-			spin_lock_irqsave(&alarm_slock, flags);
+			alarm_wakeup_lock(&flags);
 			suspended = false;
 			wake_lock_timeout(&alarm_rtc_wake_lock, 2 * HZ);
 			update_timer_locked(&alarms[ANDROID_ALARM_RTC_WAKEUP],
@@ -436,7 +557,7 @@ static int alarm_suspend(struct platform_device *pdev, pm_message_t state)
 			update_timer_locked(&alarms[
 				ANDROID_ALARM_ELAPSED_REALTIME_WAKEUP], false);
 			err = -EBUSY;
-			spin_unlock_irqrestore(&alarm_slock, flags);
+			alarm_wakeup_unlock(flags);
 		}
 	}
 	return err;
@@ -453,12 +574,12 @@ static int alarm_resume(struct platform_device *pdev)
 	alarm.enabled = 0;
 	rtc_set_alarm(alarm_rtc_dev, &alarm);
 
-	spin_lock_irqsave(&alarm_slock, flags);
+	alarm_wakeup_lock(&flags);
 	suspended = false;
 	update_timer_locked(&alarms[ANDROID_ALARM_RTC_WAKEUP], false);
 	update_timer_locked(&alarms[ANDROID_ALARM_ELAPSED_REALTIME_WAKEUP],
 									false);
-	spin_unlock_irqrestore(&alarm_slock, flags);
+	alarm_wakeup_unlock(flags);
 
 	return 0;
 }
@@ -533,7 +654,7 @@ static int __init alarm_late_init(void)
 	struct timespec tmp_time, system_time;
 
 	/* this needs to run after the rtc is read at boot */
-	spin_lock_irqsave(&alarm_slock, flags);
+	write_seqlock_irqsave(&alarm_time_lock, flags);
 	/* We read the current rtc and system time so we can later calulate
 	 * elasped realtime to be (boot_systemtime + rtc - boot_rtc) ==
 	 * (rtc - (boot_rtc - boot_systemtime))
@@ -543,8 +664,9 @@ static int __init alarm_late_init(void)
 	alarms[ANDROID_ALARM_ELAPSED_REALTIME_WAKEUP].delta =
 		alarms[ANDROID_ALARM_ELAPSED_REALTIME].delta =
 			timespec_to_ktime(timespec_sub(tmp_time, system_time));
+	alarm_publish_time_locked();
 
-	spin_unlock_irqrestore(&alarm_slock, flags);
+	write_sequnlock_irqrestore(&alarm_time_lock, flags);
 	return 0;
 }
 
@@ -553,6 +675,14 @@ static int __init alarm_driver_init(void)
 	int err;
 	int i;
 
+	alarm_time = (struct android_alarm_time *)get_zeroed_page(GFP_KERNEL);
+	if (!alarm_time)
+		return -ENOMEM;
+
+	for (i = 0; i < ANDROID_ALARM_TYPE_COUNT; i++) {
+		spin_lock_init(&alarms[i].lock);
+		init_waitqueue_head(&alarms[i].running_wait);
+	}
 	for (i = 0; i < ANDROID_ALARM_SYSTEMTIME; i++) {
 		hrtimer_init(&alarms[i].timer,
 				CLOCK_REALTIME, HRTIMER_MODE_ABS);
@@ -576,6 +706,8 @@ err2:
 	wake_lock_destroy(&alarm_rtc_wake_lock);
 	platform_driver_unregister(&alarm_driver);
 err1:
+	free_page((unsigned long)alarm_time);
+	alarm_time = NULL;
 	return err;
 }
 
@@ -584,6 +716,7 @@ static void  __exit alarm_exit(void)
 	class_interface_unregister(&rtc_alarm_interface);
 	wake_lock_destroy(&alarm_rtc_wake_lock);
 	platform_driver_unregister(&alarm_driver);
+	free_page((unsigned long)alarm_time);
 }
 
 late_initcall(alarm_late_init);
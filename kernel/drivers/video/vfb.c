@@ -17,25 +17,106 @@
 #include <linux/mm.h>
 #include <linux/vmalloc.h>
 #include <linux/delay.h>
+#include <linux/eventfd.h>
 #include <linux/interrupt.h>
+#include <linux/hrtimer.h>
 #include <linux/platform_device.h>
+#include <linux/pagemap.h>
+#include <linux/rmap.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
 
 #include <linux/fb.h>
 #include <linux/init.h>
+#include <linux/vfb.h>
 
     /*
-     *  RAM we reserve for the frame buffer. This defines the maximum screen
+     *  Initial video mode. buffers is the number of screens stacked in
+     *  yres_virtual for the producer to flip between
+     */
+
+    /*
+     *  Number of framebuffers to create. Each one has its own video memory
+     *  and mode, and the mode parameters take one value per instance, the
+     *  last value given applying to the rest
+     */
+
+static int vfb_count = 1;
+module_param(vfb_count, int, 0);
+
+static int xres[FB_MAX] = { 640 };
+static int nr_xres;
+module_param_array(xres, int, &nr_xres, 0);
+static int yres[FB_MAX] = { 480 };
+static int nr_yres;
+module_param_array(yres, int, &nr_yres, 0);
+static int bpp[FB_MAX] = { 16 };
+static int nr_bpp;
+module_param_array(bpp, int, &nr_bpp, 0);
+static int buffers[FB_MAX] = { 2 };
+static int nr_buffers;
+module_param_array(buffers, int, &nr_buffers, 0);
+
+static int vfb_param(const int *values, int n, int id)
+{
+	return values[min(id, max(n, 1) - 1)];
+}
+
+    /*
+     *  RAM we reserve for each frame buffer. This defines the maximum screen
      *  size
      *
-     *  The default can be overridden if the driver is compiled as a module
+     *  By default it is just enough for the initial mode, setting it larger
+     *  leaves room for bigger modes later
      */
 
-#define VIDEOMEMSIZE	(4*1024*1024)	/* 4 MB */
-
-static void *videomemory;
-static u_long videomemorysize = VIDEOMEMSIZE;
+static u_long videomemorysize;
 module_param(videomemorysize, ulong, 0);
 
+    /*
+     *  Track which pages of video memory have been written, so that the
+     *  viewer only has to copy what actually changed (VFBIO_GET_DAMAGE)
+     */
+
+static int track_damage = 1;
+module_param(track_damage, bool, 0);
+
+    /*
+     *  Virtual vertical refresh. Pans are latched on the next vblank, like
+     *  on real hardware, and FBIO_WAITFORVSYNC waits for it. 0 pans
+     *  immediately and has no vblank
+     */
+
+static int vsync_hz = 60;
+module_param(vsync_hz, int, 0);
+
+struct vfb_par {
+	struct fb_info *info;
+	void *videomemory;
+	u_long videomemorysize;
+	u32 palette[256];
+	unsigned long *dirty;	/* one bit per page of video memory */
+	unsigned long npages;
+	u32 frame_seq;		/* bumped on every pan */
+	struct vfb_status *status;	/* mapped read-only to userspace */
+	int users;			/* opens, under info->lock */
+
+	spinlock_t vsync_lock;		/* protects the fields below */
+	struct eventfd_ctx *frame_eventfd;	/* signalled on every pan */
+	struct hrtimer vsync_timer;	/* only runs while someone waits */
+	ktime_t vsync_period;
+	int vsync_armed;
+	int vsync_waiters;
+	u32 vsync_count;
+	wait_queue_head_t vsync_wait;
+	int pan_pending;		/* a pan waits for the next vblank */
+	u32 pan_xoffset;
+	u32 pan_yoffset;
+	u32 front_xoffset;		/* the buffer on screen */
+	u32 front_yoffset;
+};
+
 /**********************************************************************
  *
  * Memory management
@@ -71,7 +152,10 @@ static void rvfree(void *mem, unsigned long size)
 
 	adr = (unsigned long) mem;
 	while ((long) size > 0) {
-		ClearPageReserved(vmalloc_to_page((void *)adr));
+		struct page *page = vmalloc_to_page((void *)adr);
+
+		page->mapping = NULL;	/* set up by vfb_vm_fault() */
+		ClearPageReserved(page);
 		adr += PAGE_SIZE;
 		size -= PAGE_SIZE;
 	}
@@ -84,9 +168,9 @@ static struct fb_var_screeninfo vfb_default __devinitdata = {
 	.xres_virtual =	640,
 	.yres_virtual =	960,
 	.bits_per_pixel = 16,
-	.red =		{ 0, 5, 0 },
+	.red =		{ 11, 5, 0 },
       	.green =	{ 5, 6, 0 },
-      	.blue =		{ 11, 5, 0 },
+      	.blue =		{ 0, 5, 0 },
       	.activate =	FB_ACTIVATE_TEST,
       	.height =	-1,
       	.width =	-1,
@@ -122,18 +206,33 @@ static int vfb_pan_display(struct fb_var_screeninfo *var,
 			   struct fb_info *info);
 static int vfb_mmap(struct fb_info *info,
 		    struct vm_area_struct *vma);
+static ssize_t vfb_write(struct fb_info *info, const char __user *buf,
+			 size_t count, loff_t *ppos);
+static void vfb_fillrect(struct fb_info *info,
+			 const struct fb_fillrect *rect);
+static void vfb_copyarea(struct fb_info *info,
+			 const struct fb_copyarea *area);
+static void vfb_imageblit(struct fb_info *info,
+			  const struct fb_image *image);
+static int vfb_ioctl(struct fb_info *info, unsigned int cmd,
+		     unsigned long arg);
+static int vfb_open(struct fb_info *info, int user);
+static int vfb_release(struct fb_info *info, int user);
 
 static struct fb_ops vfb_ops = {
+	.fb_open	= vfb_open,
+	.fb_release	= vfb_release,
 	.fb_read        = fb_sys_read,
-	.fb_write       = fb_sys_write,
+	.fb_write       = vfb_write,
 	.fb_check_var	= vfb_check_var,
 	.fb_set_par	= vfb_set_par,
 	.fb_setcolreg	= vfb_setcolreg,
 	.fb_pan_display	= vfb_pan_display,
-	.fb_fillrect	= sys_fillrect,
-	.fb_copyarea	= sys_copyarea,
-	.fb_imageblit	= sys_imageblit,
+	.fb_fillrect	= vfb_fillrect,
+	.fb_copyarea	= vfb_copyarea,
+	.fb_imageblit	= vfb_imageblit,
 	.fb_mmap	= vfb_mmap,
+	.fb_ioctl	= vfb_ioctl,
 };
 
     /*
@@ -150,6 +249,286 @@ static u_long get_line_length(int xres_virtual, int bpp)
 	return (length);
 }
 
+    /*
+     *  Damage tracking
+     *
+     *  Pages are mapped into userspace read-only and on demand. The first
+     *  write to a page goes through vfb_vm_page_mkwrite(), which marks it
+     *  dirty; VFBIO_GET_DAMAGE reports the dirty pages and write protects
+     *  them again. Writes done by the kernel itself (write(2) and the
+     *  console drawing ops) mark the touched range directly.
+     */
+
+static void vfb_damage_range(struct fb_info *info, unsigned long start,
+			     unsigned long len)
+{
+	struct vfb_par *par = info->par;
+	unsigned long first, last;
+
+	if (!track_damage || !len)
+		return;
+
+	first = start >> PAGE_SHIFT;
+	last = min((start + len - 1) >> PAGE_SHIFT, par->npages - 1);
+	for (; first <= last; first++)
+		set_bit(first, par->dirty);
+}
+
+static void vfb_damage_lines(struct fb_info *info, u32 y, u32 height)
+{
+	vfb_damage_range(info, y * info->fix.line_length,
+			 height * info->fix.line_length);
+}
+
+static int vfb_get_damage(struct fb_info *info,
+			  struct vfb_damage __user *argp)
+{
+	struct vfb_par *par = info->par;
+	struct vfb_damage damage;
+	struct page *page;
+	unsigned long i;
+	u8 *map;
+	int retval = 0;
+
+	if (!track_damage)
+		return -ENOTTY;
+
+	if (copy_from_user(&damage, argp, sizeof(damage)))
+		return -EFAULT;
+
+	if (damage.len < DIV_ROUND_UP(par->npages, 8))
+		return -EINVAL;
+	damage.len = DIV_ROUND_UP(par->npages, 8);
+
+	map = kzalloc(damage.len, GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+
+	/*
+	 * Clear the bit before write protecting the page: a write that
+	 * slips in between is still in memory when userspace copies the
+	 * page, and anything later faults and sets the bit again.
+	 */
+	damage.npages = 0;
+	for (i = find_first_bit(par->dirty, par->npages); i < par->npages;
+	     i = find_next_bit(par->dirty, par->npages, i + 1)) {
+		if (!test_and_clear_bit(i, par->dirty))
+			continue;
+
+		page = vmalloc_to_page(info->screen_base + (i << PAGE_SHIFT));
+		lock_page(page);
+		page_mkclean(page);
+		unlock_page(page);
+
+		map[i >> 3] |= 1 << (i & 7);
+		damage.npages++;
+	}
+
+	if (copy_to_user((void __user *)(unsigned long)damage.bitmap,
+			 map, damage.len) ||
+	    copy_to_user(argp, &damage, sizeof(damage)))
+		retval = -EFAULT;
+
+	kfree(map);
+	return retval;
+}
+
+    /*
+     *  Frame delivery
+     */
+
+/*
+ * Register the eventfd to signal on every frame. Userspace waits on it
+ * rather than in an ioctl, which would sleep holding info->lock and so
+ * keep out the very pan it waits for.
+ */
+static int vfb_set_frame_eventfd(struct fb_info *info, int __user *argp)
+{
+	struct vfb_par *par = info->par;
+	struct eventfd_ctx *ctx = NULL, *old;
+	unsigned long flags;
+	int fd;
+
+	if (get_user(fd, argp))
+		return -EFAULT;
+	if (fd >= 0) {
+		ctx = eventfd_ctx_fdget(fd);
+		if (IS_ERR(ctx))
+			return PTR_ERR(ctx);
+	}
+
+	spin_lock_irqsave(&par->vsync_lock, flags);
+	old = par->frame_eventfd;
+	par->frame_eventfd = ctx;
+	spin_unlock_irqrestore(&par->vsync_lock, flags);
+
+	if (old)
+		eventfd_ctx_put(old);
+	return 0;
+}
+
+static void vfb_update_status(struct fb_info *info)
+{
+	struct vfb_par *par = info->par;
+	struct vfb_status *status = par->status;
+
+	status->seq++;
+	smp_wmb();
+	status->frame = par->frame_seq;
+	status->xoffset = par->front_xoffset;
+	status->yoffset = par->front_yoffset;
+	smp_wmb();
+	status->seq++;
+}
+
+    /*
+     *  Virtual vsync
+     */
+
+/*
+ * Put the pending pan on screen. Called with vsync_lock held, from the
+ * vsync timer too, so only par is touched. info->var belongs to info->lock
+ * and fbmem updates it from the pan once vfb_pan_display() returns.
+ */
+static void vfb_latch_pan(struct fb_info *info)
+{
+	struct vfb_par *par = info->par;
+
+	par->front_xoffset = par->pan_xoffset;
+	par->front_yoffset = par->pan_yoffset;
+	par->pan_pending = 0;
+
+	par->frame_seq++;
+	vfb_update_status(info);
+	if (par->frame_eventfd)
+		eventfd_signal(par->frame_eventfd, 1);
+}
+
+/*
+ * Start the timer if it isn't running. vblanks always fall on multiples of
+ * the period, so they keep the same phase however often the timer stops.
+ * Called with vsync_lock held.
+ */
+static void vfb_vsync_arm(struct vfb_par *par)
+{
+	u64 now, next;
+	u32 period;
+
+	if (par->vsync_armed)
+		return;
+
+	period = ktime_to_ns(par->vsync_period);
+	now = next = ktime_to_ns(ktime_get());
+	next = now - do_div(next, period) + period;
+
+	par->vsync_armed = 1;
+	hrtimer_start(&par->vsync_timer, ns_to_ktime(next), HRTIMER_MODE_ABS);
+}
+
+static enum hrtimer_restart vfb_vsync(struct hrtimer *timer)
+{
+	struct vfb_par *par = container_of(timer, struct vfb_par, vsync_timer);
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+
+	spin_lock(&par->vsync_lock);
+	par->vsync_count++;
+	if (par->pan_pending)
+		vfb_latch_pan(par->info);
+
+	/* Keep going only while somebody is waiting for the next one */
+	if (par->vsync_waiters) {
+		hrtimer_forward_now(timer, par->vsync_period);
+		ret = HRTIMER_RESTART;
+	} else {
+		par->vsync_armed = 0;
+	}
+	spin_unlock(&par->vsync_lock);
+
+	wake_up_all(&par->vsync_wait);
+	return ret;
+}
+
+static int vfb_wait_for_vsync(struct fb_info *info, u32 __user *argp)
+{
+	struct vfb_par *par = info->par;
+	unsigned long flags;
+	u32 crtc, count;
+	long timeout;
+
+	if (get_user(crtc, argp))
+		return -EFAULT;
+	if (crtc != 0)
+		return -ENODEV;
+	if (!vsync_hz)
+		return -ENOTTY;
+
+	spin_lock_irqsave(&par->vsync_lock, flags);
+	count = par->vsync_count;
+	par->vsync_waiters++;
+	vfb_vsync_arm(par);
+	spin_unlock_irqrestore(&par->vsync_lock, flags);
+
+	/*
+	 * This sleeps with info->lock held, like other drivers do, so pans
+	 * wait for it. The vblank comes from the timer and needs no lock, so
+	 * that is at most one frame.
+	 */
+	timeout = wait_event_interruptible_timeout(par->vsync_wait,
+			ACCESS_ONCE(par->vsync_count) != count, HZ);
+
+	spin_lock_irqsave(&par->vsync_lock, flags);
+	par->vsync_waiters--;
+	spin_unlock_irqrestore(&par->vsync_lock, flags);
+
+	if (timeout < 0)
+		return timeout;
+	return timeout ? 0 : -ETIMEDOUT;
+}
+
+static int vfb_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct fb_info *info = vma->vm_private_data;
+	unsigned long offset = vmf->pgoff << PAGE_SHIFT;
+	struct page *page;
+
+	if (offset >= info->fix.smem_len)
+		return VM_FAULT_SIGBUS;
+
+	page = vmalloc_to_page(info->screen_base + offset);
+	if (!page)
+		return VM_FAULT_SIGBUS;
+
+	get_page(page);
+	if (vma->vm_file)
+		page->mapping = vma->vm_file->f_mapping;
+	page->index = vmf->pgoff;
+
+	vmf->page = page;
+	return 0;
+}
+
+static int vfb_vm_page_mkwrite(struct vm_area_struct *vma,
+			       struct vm_fault *vmf)
+{
+	struct fb_info *info = vma->vm_private_data;
+	struct vfb_par *par = info->par;
+	struct page *page = vmf->page;
+
+	lock_page(page);
+	set_bit(page->index, par->dirty);
+	return VM_FAULT_LOCKED;
+}
+
+static const struct vm_operations_struct vfb_vm_ops = {
+	.fault		= vfb_vm_fault,
+	.page_mkwrite	= vfb_vm_page_mkwrite,
+};
+
+/* Without damage tracking pages are simply mapped writable on first touch */
+static const struct vm_operations_struct vfb_vm_ops_untracked = {
+	.fault		= vfb_vm_fault,
+};
+
     /*
      *  Setting the video mode has been split into two parts.
      *  First part, xxxfb_check_var, must not write anything
@@ -161,6 +540,7 @@ static u_long get_line_length(int xres_virtual, int bpp)
 static int vfb_check_var(struct fb_var_screeninfo *var,
 			 struct fb_info *info)
 {
+	struct vfb_par *par = info->par;
 	u_long line_length;
 
 	/*
@@ -208,7 +588,7 @@ static int vfb_check_var(struct fb_var_screeninfo *var,
 	 */
 	line_length =
 	    get_line_length(var->xres_virtual, var->bits_per_pixel);
-	if (line_length * var->yres_virtual > videomemorysize)
+	if (line_length * var->yres_virtual > par->videomemorysize)
 		return -ENOMEM;
 
 	/*
@@ -238,12 +618,12 @@ static int vfb_check_var(struct fb_var_screeninfo *var,
 			var->blue.length = 5;
 			var->transp.offset = 15;
 			var->transp.length = 1;
-		} else {	/* RGB 565 */
-			var->red.offset = 0;
+		} else {	/* RGB 565, red in the top bits like Android */
+			var->red.offset = 11;
 			var->red.length = 5;
 			var->green.offset = 5;
 			var->green.length = 6;
-			var->blue.offset = 11;
+			var->blue.offset = 0;
 			var->blue.length = 5;
 			var->transp.offset = 0;
 			var->transp.length = 0;
@@ -259,12 +639,12 @@ static int vfb_check_var(struct fb_var_screeninfo *var,
 		var->transp.offset = 0;
 		var->transp.length = 0;
 		break;
-	case 32:		/* RGBA 8888 */
-		var->red.offset = 0;
+	case 32:		/* ARGB 8888, what cairo and X use */
+		var->red.offset = 16;
 		var->red.length = 8;
 		var->green.offset = 8;
 		var->green.length = 8;
-		var->blue.offset = 16;
+		var->blue.offset = 0;
 		var->blue.length = 8;
 		var->transp.offset = 24;
 		var->transp.length = 8;
@@ -284,8 +664,12 @@ static int vfb_check_var(struct fb_var_screeninfo *var,
  */
 static int vfb_set_par(struct fb_info *info)
 {
+	struct vfb_par *par = info->par;
+
 	info->fix.line_length = get_line_length(info->var.xres_virtual,
 						info->var.bits_per_pixel);
+	if (track_damage)
+		bitmap_fill(par->dirty, par->npages);
 	return 0;
 }
 
@@ -389,6 +773,9 @@ static int vfb_setcolreg(u_int regno, u_int red, u_int green, u_int blue,
 static int vfb_pan_display(struct fb_var_screeninfo *var,
 			   struct fb_info *info)
 {
+	struct vfb_par *par = info->par;
+	unsigned long flags;
+
 	if (var->vmode & FB_VMODE_YWRAP) {
 		if (var->yoffset < 0
 		    || var->yoffset >= info->var.yres_virtual
@@ -399,12 +786,23 @@ static int vfb_pan_display(struct fb_var_screeninfo *var,
 		    var->yoffset + var->yres > info->var.yres_virtual)
 			return -EINVAL;
 	}
-	info->var.xoffset = var->xoffset;
-	info->var.yoffset = var->yoffset;
-	if (var->vmode & FB_VMODE_YWRAP)
-		info->var.vmode |= FB_VMODE_YWRAP;
+
+	spin_lock_irqsave(&par->vsync_lock, flags);
+	par->pan_xoffset = var->xoffset;
+	par->pan_yoffset = var->yoffset;
+	par->pan_pending = 1;
+	if (!vsync_hz)
+		vfb_latch_pan(info);
 	else
-		info->var.vmode &= ~FB_VMODE_YWRAP;
+		vfb_vsync_arm(par);
+	spin_unlock_irqrestore(&par->vsync_lock, flags);
+
+	/*
+	 * Don't wait for the vblank here: fbcon pans from the console write
+	 * path, which can't sleep. A producer that must not draw into the old
+	 * buffer before the new one is on screen waits with FBIO_WAITFORVSYNC
+	 * or on the frame eventfd.
+	 */
 	return 0;
 }
 
@@ -418,30 +816,117 @@ static int vfb_mmap(struct fb_info *info,
 	unsigned long start = vma->vm_start;
 	unsigned long size = vma->vm_end - vma->vm_start;
 	unsigned long offset = vma->vm_pgoff << PAGE_SHIFT;
-	unsigned long page, pos;
+	struct vfb_par *par = info->par;
+
+	if (offset == PAGE_ALIGN(info->fix.smem_len)) {
+		/* The status page, see struct vfb_status */
+		if (size != PAGE_SIZE)
+			return -EINVAL;
+		if (vma->vm_flags & VM_WRITE)
+			return -EPERM;
+		vma->vm_flags &= ~VM_MAYWRITE;
+		vma->vm_flags |= VM_RESERVED;
+		return remap_pfn_range(vma, start,
+				       virt_to_phys(par->status) >> PAGE_SHIFT,
+				       PAGE_SIZE, vma->vm_page_prot);
+	}
 
 	if (offset + size > info->fix.smem_len) {
 		return -EINVAL;
 	}
 
-	pos = (unsigned long)info->fix.smem_start + offset;
+	/*
+	 * Pages are inserted by vfb_vm_fault() as they are touched, so mmap
+	 * costs the same however big the video memory is
+	 */
+	vma->vm_ops = track_damage ? &vfb_vm_ops : &vfb_vm_ops_untracked;
+	vma->vm_flags |= VM_RESERVED;	/* avoid to swap out this VMA */
+	vma->vm_private_data = info;
+	return 0;
+
+}
 
-	while (size > 0) {
-		page = vmalloc_to_pfn((void *)pos);
-		if (remap_pfn_range(vma, start, page, PAGE_SIZE, PAGE_SHARED)) {
-			return -EAGAIN;
-		}
-		start += PAGE_SIZE;
-		pos += PAGE_SIZE;
-		if (size > PAGE_SIZE)
-			size -= PAGE_SIZE;
-		else
-			size = 0;
+    /*
+     *  Drawing done by the kernel bypasses the page tracking above
+     */
+
+static ssize_t vfb_write(struct fb_info *info, const char __user *buf,
+			 size_t count, loff_t *ppos)
+{
+	unsigned long pos = *ppos;
+	ssize_t ret;
+
+	ret = fb_sys_write(info, buf, count, ppos);
+	if (ret > 0)
+		vfb_damage_range(info, pos, ret);
+	return ret;
+}
+
+static void vfb_fillrect(struct fb_info *info,
+			 const struct fb_fillrect *rect)
+{
+	sys_fillrect(info, rect);
+	vfb_damage_lines(info, rect->dy, rect->height);
+}
+
+static void vfb_copyarea(struct fb_info *info,
+			 const struct fb_copyarea *area)
+{
+	sys_copyarea(info, area);
+	vfb_damage_lines(info, area->dy, area->height);
+}
+
+static void vfb_imageblit(struct fb_info *info,
+			  const struct fb_image *image)
+{
+	sys_imageblit(info, image);
+	vfb_damage_lines(info, image->dy, image->height);
+}
+
+static int vfb_ioctl(struct fb_info *info, unsigned int cmd,
+		     unsigned long arg)
+{
+	void __user *argp = (void __user *)arg;
+
+	switch (cmd) {
+	case VFBIO_GET_DAMAGE:
+		return vfb_get_damage(info, argp);
+	case VFBIO_SET_FRAME_EVENTFD:
+		return vfb_set_frame_eventfd(info, argp);
+	case FBIO_WAITFORVSYNC:
+		return vfb_wait_for_vsync(info, argp);
 	}
+	return -ENOTTY;
+}
 
-	vma->vm_flags |= VM_RESERVED;	/* avoid to swap out this VMA */
+    /*
+     *  Opens are counted so the frame eventfd is dropped when the last
+     *  user goes away. Both are called with info->lock held.
+     */
+
+static int vfb_open(struct fb_info *info, int user)
+{
+	struct vfb_par *par = info->par;
+
+	par->users++;
 	return 0;
+}
 
+static int vfb_release(struct fb_info *info, int user)
+{
+	struct vfb_par *par = info->par;
+	struct eventfd_ctx *ctx = NULL;
+	unsigned long flags;
+
+	if (--par->users == 0) {
+		spin_lock_irqsave(&par->vsync_lock, flags);
+		ctx = par->frame_eventfd;
+		par->frame_eventfd = NULL;
+		spin_unlock_irqrestore(&par->vsync_lock, flags);
+	}
+	if (ctx)
+		eventfd_ctx_put(ctx);
+	return 0;
 }
 
 #ifndef MODULE
@@ -481,12 +966,36 @@ static int __init vfb_setup(char *options)
 static int __devinit vfb_probe(struct platform_device *dev)
 {
 	struct fb_info *info;
+	struct vfb_par *par;
+	struct fb_var_screeninfo var = vfb_default;
+	int xres_id = vfb_param(xres, nr_xres, dev->id);
+	int yres_id = vfb_param(yres, nr_yres, dev->id);
+	int bpp_id = vfb_param(bpp, nr_bpp, dev->id);
+	int buffers_id = vfb_param(buffers, nr_buffers, dev->id);
+	void *videomemory;
+	u_long size;
 	int retval = -ENOMEM;
 
+	if (xres_id <= 0 || yres_id <= 0 || buffers_id <= 0 || vsync_hz < 0 ||
+	    (bpp_id != 8 && bpp_id != 16 && bpp_id != 24 && bpp_id != 32)) {
+		printk(KERN_ERR "vfb.%d: invalid mode %dx%dx%d with %d buffers\n",
+		       dev->id, xres_id, yres_id, bpp_id, buffers_id);
+		return -EINVAL;
+	}
+
+	var.xres = var.xres_virtual = xres_id;
+	var.yres = yres_id;
+	var.yres_virtual = yres_id * buffers_id;
+	var.bits_per_pixel = bpp_id;
+
+	size = get_line_length(var.xres_virtual, bpp_id) * var.yres_virtual;
+	if (size < videomemorysize)
+		size = videomemorysize;
+
 	/*
 	 * For real video cards we use ioremap.
 	 */
-	if (!(videomemory = rvmalloc(videomemorysize)))
+	if (!(videomemory = rvmalloc(size)))
 		return retval;
 
 	/*
@@ -495,28 +1004,50 @@ static int __devinit vfb_probe(struct platform_device *dev)
 	 * VGA-based drivers MUST NOT clear memory if
 	 * they want to be able to take over vgacon
 	 */
-	memset(videomemory, 0, videomemorysize);
+	memset(videomemory, 0, size);
 
-	info = framebuffer_alloc(sizeof(u32) * 256, &dev->dev);
+	info = framebuffer_alloc(sizeof(struct vfb_par), &dev->dev);
 	if (!info)
 		goto err;
 
-	info->screen_base = (char __iomem *)videomemory;
-	info->fbops = &vfb_ops;
+	par = info->par;
+	par->info = info;
+	par->videomemory = videomemory;
+	par->videomemorysize = size;
+	par->npages = PAGE_ALIGN(size) >> PAGE_SHIFT;
+	par->dirty = kzalloc(BITS_TO_LONGS(par->npages) * sizeof(long),
+			     GFP_KERNEL);
+	if (!par->dirty)
+		goto err1;
 
-	//retval = fb_find_mode(&info->var, info, NULL,
-	//		      NULL, 0, NULL, 8);
+	spin_lock_init(&par->vsync_lock);
+	init_waitqueue_head(&par->vsync_wait);
+	hrtimer_init(&par->vsync_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	par->vsync_timer.function = vfb_vsync;
+	if (vsync_hz)
+		par->vsync_period = ktime_set(0, NSEC_PER_SEC / vsync_hz);
 
-	//if (!retval || (retval == 4))
-	//	info->var = vfb_default;
+	par->status = (struct vfb_status *)get_zeroed_page(GFP_KERNEL);
+	if (!par->status)
+		goto err1;
+	SetPageReserved(virt_to_page(par->status));
+
+	info->screen_base = (char __iomem *)videomemory;
+	info->fbops = &vfb_ops;
 
-	info->var = vfb_default;
+	/* Fills in the bitfields for the depth */
+	retval = vfb_check_var(&var, info);
+	if (retval < 0)
+		goto err1;
+	info->var = var;
+	par->front_xoffset = var.xoffset;
+	par->front_yoffset = var.yoffset;
+	vfb_update_status(info);
 
-	vfb_fix.smem_start = (unsigned long) videomemory;
-	vfb_fix.smem_len = videomemorysize;
 	info->fix = vfb_fix;
-	info->pseudo_palette = info->par;
-	info->par = NULL;
+	info->fix.smem_start = (unsigned long) videomemory;
+	info->fix.smem_len = size;
+	info->pseudo_palette = par->palette;
 	info->flags = FBINFO_FLAG_DEFAULT;
 
 	retval = fb_alloc_cmap(&info->cmap, 256, 0);
@@ -529,15 +1060,21 @@ static int __devinit vfb_probe(struct platform_device *dev)
 	platform_set_drvdata(dev, info);
 
 	printk(KERN_INFO
-	       "fb%d: Virtual frame buffer device, using %ldK of video memory\n",
-	       info->node, videomemorysize >> 10);
+	       "fb%d: Virtual frame buffer device, %dx%dx%d with %d buffers, "
+	       "using %ldK of video memory\n", info->node, xres_id, yres_id,
+	       bpp_id, buffers_id, size >> 10);
 	return 0;
 err2:
 	fb_dealloc_cmap(&info->cmap);
 err1:
+	if (par->status) {
+		ClearPageReserved(virt_to_page(par->status));
+		free_page((unsigned long)par->status);
+	}
+	kfree(par->dirty);
 	framebuffer_release(info);
 err:
-	rvfree(videomemory, videomemorysize);
+	rvfree(videomemory, size);
 	return retval;
 }
 
@@ -546,9 +1083,17 @@ static int vfb_remove(struct platform_device *dev)
 	struct fb_info *info = platform_get_drvdata(dev);
 
 	if (info) {
+		struct vfb_par *par = info->par;
+
 		unregister_framebuffer(info);
-		rvfree(videomemory, videomemorysize);
+		hrtimer_cancel(&par->vsync_timer);
+		if (par->frame_eventfd)
+			eventfd_ctx_put(par->frame_eventfd);
+		rvfree(par->videomemory, par->videomemorysize);
 		fb_dealloc_cmap(&info->cmap);
+		ClearPageReserved(virt_to_page(par->status));
+		free_page((unsigned long)par->status);
+		kfree(par->dirty);
 		framebuffer_release(info);
 	}
 	return 0;
@@ -562,11 +1107,12 @@ static struct platform_driver vfb_driver = {
 	},
 };
 
-static struct platform_device *vfb_device;
+static struct platform_device *vfb_devices[FB_MAX];
 
 static int __init vfb_init(void)
 {
 	int ret = 0;
+	int i;
 
 #ifndef MODULE
 	char *option = NULL;
@@ -579,22 +1125,37 @@ static int __init vfb_init(void)
 	if (!vfb_enable)
 		return -ENXIO;
 
+	if (vfb_count < 1 || vfb_count > FB_MAX) {
+		printk(KERN_ERR "vfb: vfb_count must be between 1 and %d\n",
+		       FB_MAX);
+		return -EINVAL;
+	}
+
 	ret = platform_driver_register(&vfb_driver);
+	if (ret)
+		return ret;
 
-	if (!ret) {
-		vfb_device = platform_device_alloc("vfb", 0);
+	for (i = 0; i < vfb_count; i++) {
+		vfb_devices[i] = platform_device_alloc("vfb", i);
 
-		if (vfb_device)
-			ret = platform_device_add(vfb_device);
+		if (vfb_devices[i])
+			ret = platform_device_add(vfb_devices[i]);
 		else
 			ret = -ENOMEM;
 
 		if (ret) {
-			platform_device_put(vfb_device);
-			platform_driver_unregister(&vfb_driver);
+			platform_device_put(vfb_devices[i]);
+			vfb_devices[i] = NULL;
+			break;
 		}
 	}
 
+	if (ret) {
+		while (i--)
+			platform_device_unregister(vfb_devices[i]);
+		platform_driver_unregister(&vfb_driver);
+	}
+
 	return ret;
 }
 
@@ -603,7 +1164,10 @@ module_init(vfb_init);
 #ifdef MODULE
 static void __exit vfb_exit(void)
 {
-	platform_device_unregister(vfb_device);
+	int i;
+
+	for (i = 0; i < vfb_count; i++)
+		platform_device_unregister(vfb_devices[i]);
 	platform_driver_unregister(&vfb_driver);
 }
 
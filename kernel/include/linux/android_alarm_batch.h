@@ -0,0 +1,49 @@
+/*
+ *  include/linux/android_alarm_batch.h -- Android alarm sets
+ *
+ *  Each open file of /dev/alarm has its own alarms. Besides the one alarm
+ *  per type the ANDROID_ALARM_SET and CLEAR ioctls act on, it can hold
+ *  alarms named by ids of its choosing, set and cancelled in batches.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#ifndef _LINUX_ANDROID_ALARM_BATCH_H
+#define _LINUX_ANDROID_ALARM_BATCH_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define ANDROID_ALARM_BATCH_SET		0	/* (re)start alarm id */
+#define ANDROID_ALARM_BATCH_CANCEL	1	/* cancel and forget alarm id */
+
+struct android_alarm_req {
+	__u32 id;
+	__u32 type;		/* enum android_alarm_type, for SET */
+	__u32 op;		/* ANDROID_ALARM_BATCH_* */
+	__s32 result;		/* out: 0, 1 if CANCEL found it armed, or
+				   a negative errno */
+	__s64 tv_sec;		/* expiry, in the clock of type */
+	__u32 tv_nsec;
+	__u32 padding;
+};
+
+struct android_alarm_batch {
+	__u64 reqs;		/* pointer to count struct android_alarm_req */
+	__u32 count;
+	__u32 padding;
+};
+
+#define ANDROID_ALARM_BATCH_MAX		256
+
+/*
+ * Applies the requests in order, each getting its own result. When an
+ * alarm of a set goes off, ANDROID_ALARM_WAIT returns with the bit of its
+ * type, and read() then returns the __u32 ids of the alarms that went off
+ * since the last read.
+ */
+#define ANDROID_ALARM_BATCH _IOWR('a', 8, struct android_alarm_batch)
+
+#endif /* _LINUX_ANDROID_ALARM_BATCH_H */
@@ -0,0 +1,41 @@
+/*
+ *  include/linux/android_alarm_time.h -- Android alarm time page
+ *
+ *  Layout of the read-only page /dev/alarm can be mmapped with.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#ifndef _LINUX_ANDROID_ALARM_TIME_H
+#define _LINUX_ANDROID_ALARM_TIME_H
+
+#include <linux/types.h>
+
+/*
+ * The elapsed realtime time base, what ANDROID_ALARM_GET_TIME computes
+ * for the ELAPSED_REALTIME types, so userspace can compute it without a
+ * syscall:
+ *
+ *	elapsed = (stopped ? stopped_ns : CLOCK_REALTIME) - delta_ns
+ *
+ * seq is odd while the kernel updates the page, which only happens when
+ * the wall time is set. Read seq, the fields, then seq again, and retry
+ * if it was odd or changed, with read barriers in between.
+ */
+struct android_alarm_time {
+	__u32 seq;
+	__u32 stopped;
+	__s64 delta_ns;
+	__s64 stopped_ns;
+};
+
+#ifdef __KERNEL__
+struct page;
+
+/* The page itself, for mapping it, NULL if there is none */
+struct page *alarm_time_page(void);
+#endif
+
+#endif /* _LINUX_ANDROID_ALARM_TIME_H */
@@ -0,0 +1,47 @@
+/*
+ *  include/linux/androidinput.h -- Android virtual input device
+ *
+ *  Interface of the bulk injection device of drivers/input/androidinput.c.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#ifndef _LINUX_ANDROIDINPUT_H
+#define _LINUX_ANDROIDINPUT_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * /dev/android_input takes arrays of events, either as the data of a
+ * write() or through ANDROID_INPUT_INJECT. Events are reported in order
+ * and each frame, up to and including its SYN_REPORT, is reported without
+ * events from other writers of /dev/android_input in between. Events
+ * written to the evdev node are not ordered against it. A batch that
+ * doesn't end with a SYN_REPORT gets one.
+ *
+ * At most ANDROID_INPUT_BATCH_MAX events are taken per call, ending on
+ * the last complete frame among them if there is one. write() returns
+ * the number of bytes consumed, ANDROID_INPUT_INJECT the number of events
+ * in consumed. Events carry no timestamp, the kernel stamps them as they
+ * are reported.
+ */
+struct android_input_event {
+	__u16 type;
+	__u16 code;
+	__s32 value;
+};
+
+struct android_input_inject {
+	__u64 events;		/* user pointer to struct android_input_event[] */
+	__u32 count;
+	__u32 consumed;		/* out */
+};
+
+#define ANDROID_INPUT_BATCH_MAX	256
+
+#define ANDROID_INPUT_INJECT	_IOWR('I', 0x80, struct android_input_inject)
+
+#endif /* _LINUX_ANDROIDINPUT_H */
@@ -0,0 +1,62 @@
+/*
+ *  include/linux/vfb.h -- Virtual frame buffer device extensions
+ *
+ *  Interface between drivers/video/vfb.c and the userspace viewer.
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License. See the file COPYING in the main directory of this archive for
+ *  more details.
+ */
+
+#ifndef _LINUX_VFB_H
+#define _LINUX_VFB_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Damage tracking
+ *
+ * Every page of video memory written since the previous VFBIO_GET_DAMAGE
+ * call is reported as a set bit in the caller supplied bitmap (bit n of
+ * byte n / 8 for page n, least significant bit first). Reported pages are
+ * write protected again, so the next write to them shows up in the next
+ * call.
+ */
+struct vfb_damage {
+	__u64 bitmap;		/* user pointer to the page bitmap */
+	__u32 len;		/* size of the bitmap in bytes */
+	__u32 npages;		/* out: number of damaged pages */
+};
+
+#define VFBIO_GET_DAMAGE	_IOWR('F', 0x80, struct vfb_damage)
+
+/*
+ * Frame delivery
+ *
+ * The frame sequence number is bumped every time the display is panned,
+ * i.e. every time the producer flips a new frame to the front. With the
+ * virtual vsync enabled that happens on the vblank following the pan.
+ * VFBIO_SET_FRAME_EVENTFD takes an eventfd to signal whenever it does, or
+ * -1 to stop. The sequence number itself is in the status page below.
+ * The eventfd is dropped when the last user closes the device.
+ */
+#define VFBIO_SET_FRAME_EVENTFD	_IOW('F', 0x81, int)
+
+/*
+ * Display status page
+ *
+ * A read-only page mapped at the first page aligned offset past the video
+ * memory (fix.smem_len rounded up to the page size) describes the buffer
+ * currently on screen. It is updated like a seqlock: seq is odd while the
+ * fields change, so readers sample seq, read the fields and whatever they
+ * need from the front buffer, and retry if seq was odd or has changed.
+ */
+struct vfb_status {
+	__u32 seq;
+	__u32 frame;		/* the frame sequence number */
+	__u32 xoffset;
+	__u32 yoffset;
+};
+
+#endif /* _LINUX_VFB_H */